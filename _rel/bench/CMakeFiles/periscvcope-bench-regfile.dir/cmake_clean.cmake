@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/periscvcope-bench-regfile.dir/regfile.cc.o"
+  "CMakeFiles/periscvcope-bench-regfile.dir/regfile.cc.o.d"
+  "periscvcope-bench-regfile"
+  "periscvcope-bench-regfile.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/periscvcope-bench-regfile.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,25 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/src/aot.cc" "src/CMakeFiles/periscvcope-aot.dir/aot.cc.o" "gcc" "src/CMakeFiles/periscvcope-aot.dir/aot.cc.o.d"
+  "/root/repo/src/aot_tool.cc" "src/CMakeFiles/periscvcope-aot.dir/aot_tool.cc.o" "gcc" "src/CMakeFiles/periscvcope-aot.dir/aot_tool.cc.o.d"
+  "/root/repo/src/instructions.cc" "src/CMakeFiles/periscvcope-aot.dir/instructions.cc.o" "gcc" "src/CMakeFiles/periscvcope-aot.dir/instructions.cc.o.d"
+  "/root/repo/src/ir.cc" "src/CMakeFiles/periscvcope-aot.dir/ir.cc.o" "gcc" "src/CMakeFiles/periscvcope-aot.dir/ir.cc.o.d"
+  "/root/repo/src/memory.cc" "src/CMakeFiles/periscvcope-aot.dir/memory.cc.o" "gcc" "src/CMakeFiles/periscvcope-aot.dir/memory.cc.o.d"
+  "/root/repo/src/replay.cc" "src/CMakeFiles/periscvcope-aot.dir/replay.cc.o" "gcc" "src/CMakeFiles/periscvcope-aot.dir/replay.cc.o.d"
+  "/root/repo/src/syscalls.cc" "src/CMakeFiles/periscvcope-aot.dir/syscalls.cc.o" "gcc" "src/CMakeFiles/periscvcope-aot.dir/syscalls.cc.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
@@ -0,0 +1,23 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/periscvcope-aot.dir/aot.cc.o"
+  "CMakeFiles/periscvcope-aot.dir/aot.cc.o.d"
+  "CMakeFiles/periscvcope-aot.dir/aot_tool.cc.o"
+  "CMakeFiles/periscvcope-aot.dir/aot_tool.cc.o.d"
+  "CMakeFiles/periscvcope-aot.dir/instructions.cc.o"
+  "CMakeFiles/periscvcope-aot.dir/instructions.cc.o.d"
+  "CMakeFiles/periscvcope-aot.dir/ir.cc.o"
+  "CMakeFiles/periscvcope-aot.dir/ir.cc.o.d"
+  "CMakeFiles/periscvcope-aot.dir/memory.cc.o"
+  "CMakeFiles/periscvcope-aot.dir/memory.cc.o.d"
+  "CMakeFiles/periscvcope-aot.dir/replay.cc.o"
+  "CMakeFiles/periscvcope-aot.dir/replay.cc.o.d"
+  "CMakeFiles/periscvcope-aot.dir/syscalls.cc.o"
+  "CMakeFiles/periscvcope-aot.dir/syscalls.cc.o.d"
+  "periscvcope-aot"
+  "periscvcope-aot.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/periscvcope-aot.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,24 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/src/instructions.cc" "src/CMakeFiles/periscvcope-trace.dir/instructions.cc.o" "gcc" "src/CMakeFiles/periscvcope-trace.dir/instructions.cc.o.d"
+  "/root/repo/src/memory.cc" "src/CMakeFiles/periscvcope-trace.dir/memory.cc.o" "gcc" "src/CMakeFiles/periscvcope-trace.dir/memory.cc.o.d"
+  "/root/repo/src/replay.cc" "src/CMakeFiles/periscvcope-trace.dir/replay.cc.o" "gcc" "src/CMakeFiles/periscvcope-trace.dir/replay.cc.o.d"
+  "/root/repo/src/syscalls.cc" "src/CMakeFiles/periscvcope-trace.dir/syscalls.cc.o" "gcc" "src/CMakeFiles/periscvcope-trace.dir/syscalls.cc.o.d"
+  "/root/repo/src/trace_tool.cc" "src/CMakeFiles/periscvcope-trace.dir/trace_tool.cc.o" "gcc" "src/CMakeFiles/periscvcope-trace.dir/trace_tool.cc.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  "/root/repo/_rel/src/CMakeFiles/periscvcope_trace.dir/DependInfo.cmake"
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
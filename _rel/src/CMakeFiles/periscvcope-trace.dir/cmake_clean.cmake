@@ -0,0 +1,19 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/periscvcope-trace.dir/instructions.cc.o"
+  "CMakeFiles/periscvcope-trace.dir/instructions.cc.o.d"
+  "CMakeFiles/periscvcope-trace.dir/memory.cc.o"
+  "CMakeFiles/periscvcope-trace.dir/memory.cc.o.d"
+  "CMakeFiles/periscvcope-trace.dir/replay.cc.o"
+  "CMakeFiles/periscvcope-trace.dir/replay.cc.o.d"
+  "CMakeFiles/periscvcope-trace.dir/syscalls.cc.o"
+  "CMakeFiles/periscvcope-trace.dir/syscalls.cc.o.d"
+  "CMakeFiles/periscvcope-trace.dir/trace_tool.cc.o"
+  "CMakeFiles/periscvcope-trace.dir/trace_tool.cc.o.d"
+  "periscvcope-trace"
+  "periscvcope-trace.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/periscvcope-trace.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
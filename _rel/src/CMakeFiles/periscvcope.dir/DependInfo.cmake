@@ -0,0 +1,42 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/src/analysis.cc" "src/CMakeFiles/periscvcope.dir/analysis.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/analysis.cc.o.d"
+  "/root/repo/src/aot.cc" "src/CMakeFiles/periscvcope.dir/aot.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/aot.cc.o.d"
+  "/root/repo/src/bpred.cc" "src/CMakeFiles/periscvcope.dir/bpred.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/bpred.cc.o.d"
+  "/root/repo/src/cache.cc" "src/CMakeFiles/periscvcope.dir/cache.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/cache.cc.o.d"
+  "/root/repo/src/callstack.cc" "src/CMakeFiles/periscvcope.dir/callstack.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/callstack.cc.o.d"
+  "/root/repo/src/checkpoint.cc" "src/CMakeFiles/periscvcope.dir/checkpoint.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/checkpoint.cc.o.d"
+  "/root/repo/src/codecache.cc" "src/CMakeFiles/periscvcope.dir/codecache.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/codecache.cc.o.d"
+  "/root/repo/src/compiler.cc" "src/CMakeFiles/periscvcope.dir/compiler.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/compiler.cc.o.d"
+  "/root/repo/src/engine.cc" "src/CMakeFiles/periscvcope.dir/engine.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/engine.cc.o.d"
+  "/root/repo/src/instructions.cc" "src/CMakeFiles/periscvcope.dir/instructions.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/instructions.cc.o.d"
+  "/root/repo/src/intercept.cc" "src/CMakeFiles/periscvcope.dir/intercept.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/intercept.cc.o.d"
+  "/root/repo/src/ir.cc" "src/CMakeFiles/periscvcope.dir/ir.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/ir.cc.o.d"
+  "/root/repo/src/lockstep.cc" "src/CMakeFiles/periscvcope.dir/lockstep.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/lockstep.cc.o.d"
+  "/root/repo/src/main.cc" "src/CMakeFiles/periscvcope.dir/main.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/main.cc.o.d"
+  "/root/repo/src/memory.cc" "src/CMakeFiles/periscvcope.dir/memory.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/memory.cc.o.d"
+  "/root/repo/src/parallel.cc" "src/CMakeFiles/periscvcope.dir/parallel.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/parallel.cc.o.d"
+  "/root/repo/src/replay.cc" "src/CMakeFiles/periscvcope.dir/replay.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/replay.cc.o.d"
+  "/root/repo/src/sampler.cc" "src/CMakeFiles/periscvcope.dir/sampler.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/sampler.cc.o.d"
+  "/root/repo/src/sampling.cc" "src/CMakeFiles/periscvcope.dir/sampling.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/sampling.cc.o.d"
+  "/root/repo/src/stackdist.cc" "src/CMakeFiles/periscvcope.dir/stackdist.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/stackdist.cc.o.d"
+  "/root/repo/src/syscalls.cc" "src/CMakeFiles/periscvcope.dir/syscalls.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/syscalls.cc.o.d"
+  "/root/repo/src/timeline.cc" "src/CMakeFiles/periscvcope.dir/timeline.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/timeline.cc.o.d"
+  "/root/repo/src/timing.cc" "src/CMakeFiles/periscvcope.dir/timing.cc.o" "gcc" "src/CMakeFiles/periscvcope.dir/timing.cc.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  "/root/repo/_rel/src/CMakeFiles/periscvcope_trace.dir/DependInfo.cmake"
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
@@ -0,0 +1,55 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/periscvcope.dir/analysis.cc.o"
+  "CMakeFiles/periscvcope.dir/analysis.cc.o.d"
+  "CMakeFiles/periscvcope.dir/aot.cc.o"
+  "CMakeFiles/periscvcope.dir/aot.cc.o.d"
+  "CMakeFiles/periscvcope.dir/bpred.cc.o"
+  "CMakeFiles/periscvcope.dir/bpred.cc.o.d"
+  "CMakeFiles/periscvcope.dir/cache.cc.o"
+  "CMakeFiles/periscvcope.dir/cache.cc.o.d"
+  "CMakeFiles/periscvcope.dir/callstack.cc.o"
+  "CMakeFiles/periscvcope.dir/callstack.cc.o.d"
+  "CMakeFiles/periscvcope.dir/checkpoint.cc.o"
+  "CMakeFiles/periscvcope.dir/checkpoint.cc.o.d"
+  "CMakeFiles/periscvcope.dir/codecache.cc.o"
+  "CMakeFiles/periscvcope.dir/codecache.cc.o.d"
+  "CMakeFiles/periscvcope.dir/compiler.cc.o"
+  "CMakeFiles/periscvcope.dir/compiler.cc.o.d"
+  "CMakeFiles/periscvcope.dir/engine.cc.o"
+  "CMakeFiles/periscvcope.dir/engine.cc.o.d"
+  "CMakeFiles/periscvcope.dir/instructions.cc.o"
+  "CMakeFiles/periscvcope.dir/instructions.cc.o.d"
+  "CMakeFiles/periscvcope.dir/intercept.cc.o"
+  "CMakeFiles/periscvcope.dir/intercept.cc.o.d"
+  "CMakeFiles/periscvcope.dir/ir.cc.o"
+  "CMakeFiles/periscvcope.dir/ir.cc.o.d"
+  "CMakeFiles/periscvcope.dir/lockstep.cc.o"
+  "CMakeFiles/periscvcope.dir/lockstep.cc.o.d"
+  "CMakeFiles/periscvcope.dir/main.cc.o"
+  "CMakeFiles/periscvcope.dir/main.cc.o.d"
+  "CMakeFiles/periscvcope.dir/memory.cc.o"
+  "CMakeFiles/periscvcope.dir/memory.cc.o.d"
+  "CMakeFiles/periscvcope.dir/parallel.cc.o"
+  "CMakeFiles/periscvcope.dir/parallel.cc.o.d"
+  "CMakeFiles/periscvcope.dir/replay.cc.o"
+  "CMakeFiles/periscvcope.dir/replay.cc.o.d"
+  "CMakeFiles/periscvcope.dir/sampler.cc.o"
+  "CMakeFiles/periscvcope.dir/sampler.cc.o.d"
+  "CMakeFiles/periscvcope.dir/sampling.cc.o"
+  "CMakeFiles/periscvcope.dir/sampling.cc.o.d"
+  "CMakeFiles/periscvcope.dir/stackdist.cc.o"
+  "CMakeFiles/periscvcope.dir/stackdist.cc.o.d"
+  "CMakeFiles/periscvcope.dir/syscalls.cc.o"
+  "CMakeFiles/periscvcope.dir/syscalls.cc.o.d"
+  "CMakeFiles/periscvcope.dir/timeline.cc.o"
+  "CMakeFiles/periscvcope.dir/timeline.cc.o.d"
+  "CMakeFiles/periscvcope.dir/timing.cc.o"
+  "CMakeFiles/periscvcope.dir/timing.cc.o.d"
+  "periscvcope"
+  "periscvcope.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/periscvcope.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/periscvcope_trace.dir/trace.cc.o"
+  "CMakeFiles/periscvcope_trace.dir/trace.cc.o.d"
+  "libperiscvcope_trace.a"
+  "libperiscvcope_trace.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/periscvcope_trace.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
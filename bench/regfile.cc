@@ -0,0 +1,75 @@
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <instructions.hh>
+#include <processor.hh>
+
+// Writeback microbenchmark: a stream of addi with random destinations, a
+// quarter of them x0 like the jumps and nops of real code, runs on the
+// processor register file and on the former one, which tests the index on
+// every write. The stream is too long for the branch predictor to learn.
+namespace {
+
+// the register file before the write sink
+class branching {
+  private:
+  std::array<uint32_t, 32> _reg_file{};
+
+  public:
+  uint32_t read_reg(size_t i) const { assert(i<32); return _reg_file[i]; }
+  void write_reg(size_t i, uint32_t val) { assert(i<32); if(i>0) { _reg_file[i] = val; } }
+};
+
+constexpr size_t program_size = 1 << 20;
+constexpr size_t rounds = 80;
+
+template<typename R>
+double run(const std::vector<uint32_t>& program, uint32_t& check)
+{
+    double best = 0;
+    for (int trial = 0; trial < 5; ++trial) {
+        R regs;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (uint32_t bitstream : program) {
+                instrs::i_instruction ii{bitstream};
+                regs.write_reg(ii.rd(), regs.read_reg(ii.rs1()) + ii.imm());
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = elapsed.count() / static_cast<double>(rounds * program.size());
+        best = trial == 0 ? ns : std::min(best, ns);
+        for (size_t i = 0; i < 32; ++i) {
+            check += regs.read_reg(i);
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 rng(42);
+    std::vector<uint32_t> program;
+    for (size_t i = 0; i < program_size; ++i) {
+        uint32_t rd = rng() % 4 == 0 ? 0 : 1 + rng() % 31;
+        uint32_t rs1 = rng() % 32;
+        uint32_t imm = rng() % 4096;
+        program.push_back((imm << 20) | (rs1 << 15) | (rd << 7) | 0b0010011);
+    }
+
+    uint32_t check = 0;
+    double before = run<branching>(program, check);
+    double after = run<processor>(program, check);
+    std::cout << "Writebacks: " << rounds * program_size << " per run, 25% to x0" << std::endl
+              << "  test and branch: " << before << " ns each" << std::endl
+              << "  write sink:      " << after << " ns each (" << before / after << "x)" << std::endl
+              << "  (checksum " << check << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,24 @@
+# Test driver, run with cmake -P: records a run of PROGRAM in LOG and
+# replays it, both seeking to SEEK. The two must show the same state, which
+# must also match the EXPECTED regular expression.
+
+execute_process(COMMAND ${SIMULATOR} --record=${LOG} --seek=${SEEK} ${PROGRAM}
+  RESULT_VARIABLE status OUTPUT_VARIABLE recorded)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "Recording ${PROGRAM} exited with ${status}")
+endif()
+execute_process(COMMAND ${SIMULATOR} --replay=${LOG} --seek=${SEEK} ${PROGRAM}
+  RESULT_VARIABLE status OUTPUT_VARIABLE replayed)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "Replaying ${PROGRAM} exited with ${status}")
+endif()
+
+# the pc and the registers, up to the instruction count that follows
+string(REGEX MATCH "State after[^N]*" recorded_state "${recorded}")
+string(REGEX MATCH "State after[^N]*" replayed_state "${replayed}")
+if(recorded_state STREQUAL "" OR NOT recorded_state STREQUAL replayed_state)
+  message(FATAL_ERROR "Recorded:\n${recorded_state}\nReplayed:\n${replayed_state}")
+endif()
+if(NOT replayed_state MATCHES "${EXPECTED}")
+  message(FATAL_ERROR "Expected ${EXPECTED}, got:\n${replayed_state}")
+endif()
@@ -0,0 +1,21 @@
+# Test driver, run with cmake -P: records a trace of PROGRAM run with
+# OPTIONS and compares its dump with the EXPECTED file.
+
+separate_arguments(options UNIX_COMMAND "${OPTIONS}")
+execute_process(COMMAND ${SIMULATOR} ${options} --trace=${TRACE} ${PROGRAM}
+  RESULT_VARIABLE status OUTPUT_QUIET)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "${PROGRAM} exited with ${status}")
+endif()
+
+execute_process(COMMAND ${TRACE_TOOL} dump ${TRACE}
+  RESULT_VARIABLE status OUTPUT_VARIABLE dump)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "Unable to dump ${TRACE}")
+endif()
+
+file(READ ${EXPECTED} expected)
+if(NOT dump STREQUAL expected)
+  file(WRITE ${TRACE}.txt "${dump}")
+  message(FATAL_ERROR "The dump of ${TRACE} differs from ${EXPECTED}, see ${TRACE}.txt")
+endif()
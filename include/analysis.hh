@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <trace.hh>
+
+// Asynchronous instrumentation. The interpreter fills retire events, which
+// carry the memory access of the instruction as well, into batches of a
+// ring buffer with a single producer. Every consumer thread has its own read
+// cursor and runs its plugins over each batch, so analyses run on spare
+// cores and the interpreter only waits when the slowest consumer is a full
+// ring behind.
+namespace analysis {
+
+using event = trace::record;
+
+class plugin {
+  public:
+    virtual ~plugin() = default;
+
+    // called from the consumer thread the plugin belongs to
+    virtual void on_batch(const event* events, size_t n) = 0;
+
+    // called from the interpreter thread once all the events are consumed
+    virtual void report(std::ostream&) {}
+};
+
+class dispatcher {
+  private:
+    constexpr static size_t batch_size = 4096;
+
+    struct batch {
+        size_t _count;
+        std::array<event, batch_size> _events;
+    };
+
+    struct consumer {
+        alignas(64) std::atomic<uint64_t> _tail; // batches consumed
+        std::vector<std::unique_ptr<plugin>> _plugins;
+        std::thread _thread;
+    };
+
+    // set in _head once the producer is done, so a single atomic wakes the
+    // consumers both for new batches and for termination
+    constexpr static uint64_t done_bit = static_cast<uint64_t>(1) << 63;
+
+    std::vector<batch> _ring;
+    alignas(64) std::atomic<uint64_t> _head; // batches published
+    std::vector<std::unique_ptr<consumer>> _consumers;
+    batch* _current;
+
+    void publish();
+    void run(consumer& c);
+    uint64_t slowest() const;
+
+  public:
+    explicit dispatcher(size_t ring_batches = 16);
+    ~dispatcher();
+
+    dispatcher(const dispatcher&) = delete;
+    dispatcher& operator=(const dispatcher&) = delete;
+
+    // plugins added together share a consumer thread, call before start
+    void add_consumer(std::vector<std::unique_ptr<plugin>> plugins);
+    void add_consumer(std::unique_ptr<plugin> p);
+
+    bool empty() const { return _consumers.empty(); }
+
+    void start();
+
+    // slot for the next event, valid until the following call
+    event& next()
+    {
+        if (_current->_count == batch_size) {
+            publish();
+        }
+        return _current->_events[_current->_count++];
+    }
+
+    // flush the last batch, wait for the consumers and print their reports
+    void finish(std::ostream& os);
+};
+
+// writes the events into a binary trace
+class trace_plugin : public plugin {
+  private:
+    trace::writer _writer;
+
+  public:
+    trace_plugin(const std::string& path, const trace::regs_t& regs, mem::address_t pc);
+
+    void on_batch(const event* events, size_t n) override;
+    void report(std::ostream& os) override;
+};
+
+// retired instructions per handler and memory traffic
+class mix_plugin : public plugin {
+  private:
+    std::array<uint64_t, 128> _opcodes;
+    uint64_t _loaded;
+    uint64_t _stored;
+
+  public:
+    mix_plugin() : _opcodes(), _loaded(0), _stored(0) {}
+
+    void on_batch(const event* events, size_t n) override;
+    void report(std::ostream& os) override;
+};
+
+} // namespace analysis
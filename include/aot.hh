@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include <ir.hh>
+#include <memory.hh>
+#include <processor.hh>
+
+// Ahead-of-time translation. periscvcope-aot walks the executable segments
+// of a program, recovers its basic blocks and writes a C++ translation unit
+// with one function per block, generated from its optimised IR and built
+// into a shared object with the host
+// compiler. The block engine loads it with --aot and interprets the code
+// the translation did not discover.
+namespace aot {
+
+// bumped when the interface of the translated functions changes; the
+// objects must also be rebuilt with the simulator, they inline its headers
+constexpr uint32_t version = 5;
+
+// what a block returns, as for the IR it is translated from
+using outcome = ir::outcome;
+
+// runs the whole block and adds its instructions to retired
+using block_fn = outcome (*)(mem::memory&, processor&, uint64_t&);
+
+struct entry {
+    mem::address_t _pc;
+    uint32_t _length; // instructions
+    block_fn _fn;
+};
+
+// exported by the shared object under the name of image_symbol
+struct image {
+    uint32_t _version;
+    uint64_t _hash; // of the executable segments it was translated from
+    uint64_t _count;
+    const entry* _entries;
+};
+
+constexpr const char* image_symbol = "periscvcope_aot_image";
+
+// FNV-1a of the addresses and contents of the executable segments
+uint64_t text_hash(const mem::memory& mem);
+
+// writes the translation unit of the program loaded in mem
+void translate(const mem::memory& mem, std::ostream& os);
+
+// A translated shared object, checked against the program in memory
+class module {
+  private:
+    void* _handle;
+    std::unordered_map<mem::address_t, const entry*> _entries;
+
+  public:
+    module(const std::string& file, const mem::memory& mem);
+    ~module();
+
+    module(const module&) = delete;
+    module& operator=(const module&) = delete;
+
+    // block starting at pc, or nullptr
+    const entry* find(mem::address_t pc) const
+    {
+        auto it = _entries.find(pc);
+        return it == _entries.end() ? nullptr : it->second;
+    }
+
+    size_t blocks() const { return _entries.size(); }
+};
+
+} // namespace aot
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <memory.hh>
+
+// Branch prediction models fed with the outcomes of the retired control
+// transfers. Direction predictors only see conditional branches; a BTB and
+// a return address stack model the targets. All tables are bit-packed
+// arrays, so several predictors fit side by side in the host caches.
+namespace bpred {
+
+// n counters of B bits packed in 64-bit words
+template<unsigned B>
+class packed_array {
+  private:
+    static_assert(B > 0 && 64 % B == 0);
+    constexpr static unsigned per_word = 64 / B;
+    constexpr static uint64_t mask = (B == 64) ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << B) - 1;
+
+    std::vector<uint64_t> _words;
+
+  public:
+    packed_array(size_t n, uint64_t init) : _words((n + per_word - 1) / per_word, 0)
+    {
+        uint64_t word = 0;
+        for (unsigned i = 0; i < per_word; ++i) {
+            word |= (init & mask) << (i * B);
+        }
+        for (auto& w : _words) {
+            w = word;
+        }
+    }
+
+    uint64_t get(size_t i) const { return (_words[i / per_word] >> ((i % per_word) * B)) & mask; }
+
+    void set(size_t i, uint64_t v)
+    {
+        uint64_t& w = _words[i / per_word];
+        unsigned shift = (i % per_word) * B;
+        w = (w & ~(mask << shift)) | ((v & mask) << shift);
+    }
+
+    // saturating counter update
+    void train(size_t i, bool up)
+    {
+        uint64_t v = get(i);
+        if (up && v < mask) {
+            set(i, v + 1);
+        } else if (!up && v > 0) {
+            set(i, v - 1);
+        }
+    }
+
+    size_t bytes() const { return _words.size() * sizeof(uint64_t); }
+};
+
+// direction predictor for conditional branches
+class predictor {
+  public:
+    virtual ~predictor() = default;
+    virtual std::string name() const = 0;
+    virtual size_t bytes() const = 0;
+    virtual bool predict(mem::address_t pc, mem::address_t target) = 0;
+    // called after predict for the same branch
+    virtual void update(mem::address_t pc, bool taken) = 0;
+};
+
+// backward taken, forward not taken
+class static_btfn : public predictor {
+  public:
+    std::string name() const override { return "static"; }
+    size_t bytes() const override { return 0; }
+    bool predict(mem::address_t pc, mem::address_t target) override { return target < pc; }
+    void update(mem::address_t, bool) override {}
+};
+
+class bimodal : public predictor {
+  private:
+    unsigned _bits;
+    packed_array<2> _counters;
+
+  public:
+    explicit bimodal(unsigned bits) : _bits(bits), _counters(static_cast<size_t>(1) << bits, 1) {}
+    std::string name() const override;
+    size_t bytes() const override { return _counters.bytes(); }
+    bool predict(mem::address_t pc, mem::address_t) override;
+    void update(mem::address_t pc, bool taken) override;
+};
+
+class gshare : public predictor {
+  private:
+    unsigned _bits;
+    unsigned _history_bits;
+    uint64_t _history;
+    packed_array<2> _counters;
+
+    size_t index(mem::address_t pc) const;
+
+  public:
+    gshare(unsigned bits, unsigned history_bits) : _bits(bits), _history_bits(history_bits),
+        _history(0), _counters(static_cast<size_t>(1) << bits, 1) {}
+    std::string name() const override;
+    size_t bytes() const override { return _counters.bytes(); }
+    bool predict(mem::address_t pc, mem::address_t) override;
+    void update(mem::address_t pc, bool taken) override;
+};
+
+// bimodal base plus four tagged tables with geometric history lengths
+class tage_lite : public predictor {
+  private:
+    constexpr static unsigned tables = 4;
+    constexpr static unsigned table_bits = 10;
+    constexpr static unsigned history_lengths[tables] = {5, 12, 27, 64};
+
+    // entry: 3-bit counter, 2-bit useful, 11-bit tag, never 0 once allocated
+    struct entry_bits {
+        static uint16_t ctr(uint16_t e) { return e & 0x7; }
+        static uint16_t useful(uint16_t e) { return (e >> 3) & 0x3; }
+        static uint16_t tag(uint16_t e) { return e >> 5; }
+        static uint16_t make(uint16_t ctr, uint16_t useful, uint16_t tag)
+        {
+            return static_cast<uint16_t>(ctr | (useful << 3) | (tag << 5));
+        }
+    };
+
+    packed_array<2> _base;
+    std::vector<packed_array<16>> _tagged;
+    uint64_t _history;
+    uint64_t _branches;
+    uint32_t _seed;
+
+    // state of the last prediction, reused by update
+    size_t _index[tables];
+    uint16_t _tag[tables];
+    int _provider;
+    bool _provider_pred;
+    bool _alt_pred;
+
+    uint32_t fold(unsigned length, unsigned bits) const;
+
+  public:
+    tage_lite();
+    std::string name() const override { return "tage"; }
+    size_t bytes() const override;
+    bool predict(mem::address_t pc, mem::address_t) override;
+    void update(mem::address_t pc, bool taken) override;
+};
+
+// direct-mapped branch target buffer, valid | tag | target packed in 64 bits
+class btb {
+  private:
+    unsigned _bits;
+    std::vector<uint64_t> _entries;
+
+  public:
+    explicit btb(unsigned bits) : _bits(bits), _entries(static_cast<size_t>(1) << bits, 0) {}
+    bool hit(mem::address_t pc, mem::address_t target) const;
+    void update(mem::address_t pc, mem::address_t target);
+    size_t entries() const { return _entries.size(); }
+};
+
+class ras {
+  private:
+    std::vector<mem::address_t> _stack;
+    size_t _top;
+
+  public:
+    explicit ras(size_t n) : _stack(n, 0), _top(0) {}
+    void push(mem::address_t ret) { _stack[_top++ % _stack.size()] = ret; }
+    mem::address_t pop() { return _stack[--_top % _stack.size()]; }
+    size_t entries() const { return _stack.size(); }
+};
+
+// runs all the models on every retired control transfer
+class simulator {
+  private:
+    struct branch_stats {
+        uint64_t _executed;
+        uint64_t _taken;
+        std::vector<uint64_t> _mispredicts;
+    };
+
+    std::vector<std::unique_ptr<predictor>> _predictors;
+    std::vector<uint64_t> _mispredicts;
+    std::unordered_map<mem::address_t, branch_stats> _branches;
+    uint64_t _conditional;
+    uint64_t _taken;
+
+    btb _btb;
+    uint64_t _transfers;   // taken transfers looked up in the btb
+    uint64_t _btb_hits;
+    ras _ras;
+    uint64_t _returns;
+    uint64_t _ras_hits;
+
+  public:
+    // comma separated list of static, bimodal, gshare and tage
+    explicit simulator(const std::string& spec);
+
+    // every retired jal, jalr and branch
+    void on_control(uint32_t bitstream, mem::address_t pc, mem::address_t next_pc);
+
+    void report(std::ostream& os, const mem::memory& mem, uint64_t retired) const;
+};
+
+} // namespace bpred
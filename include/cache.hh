@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <memory.hh>
+
+// Cache hierarchy model observing the fetches and data accesses of
+// mem::memory: split L1 instruction and data caches and an optional unified
+// L2. Tags are kept as a structure of arrays, one contiguous row of ways per
+// set, so a lookup is a single SIMD compare for the usual associativities.
+namespace cache {
+
+enum class policy { lru, plru, random };
+
+struct config {
+    std::string _name;
+    size_t _size;
+    size_t _assoc;
+    size_t _line;
+    policy _policy;
+    bool _write_back; // write-back with write allocate, or write-through without
+};
+
+struct stats {
+    uint64_t _reads;
+    uint64_t _writes;
+    uint64_t _read_misses;
+    uint64_t _write_misses;
+    uint64_t _evictions;
+    uint64_t _writebacks;
+
+    uint64_t accesses() const { return _reads + _writes; }
+    uint64_t misses() const { return _read_misses + _write_misses; }
+    stats& operator+=(const stats& o);
+};
+
+class level {
+  private:
+    constexpr static uint32_t invalid = ~static_cast<uint32_t>(0);
+
+    config _cfg;
+    size_t _sets;
+    unsigned _line_bits;
+    level* _next;
+
+    std::vector<uint32_t> _tags;   // line address per way, sets x assoc
+    std::vector<uint8_t> _dirty;
+    std::vector<uint64_t> _stamps; // last use per way for lru
+    std::vector<uint64_t> _tree;   // tree bits per set for plru
+    uint64_t _clock; // lru time, 64 bits so it never wraps
+    uint32_t _seed;
+
+    stats _stats;
+    std::unordered_map<mem::address_t, uint64_t> _pc_misses;
+
+    size_t find(size_t set, uint32_t tag) const;
+    size_t victim(size_t set);
+    void touch(size_t set, size_t way);
+    void fill(size_t set, uint32_t tag, bool dirty, mem::address_t pc);
+
+  public:
+    level(const config& cfg, level* next);
+
+    const config& cfg() const { return _cfg; }
+    const stats& get_stats() const { return _stats; }
+    const std::unordered_map<mem::address_t, uint64_t>& pc_misses() const { return _pc_misses; }
+
+    // returns true on hit
+    bool access(mem::address_t addr, bool write, mem::address_t pc);
+
+    void reset_stats();
+};
+
+class hierarchy : public mem::observer {
+  private:
+    std::vector<std::unique_ptr<level>> _levels; // lowest level last
+    level* _l1i;
+    level* _l1d;
+    mem::address_t _pc; // pc of the last fetch, owner of the data accesses
+
+  public:
+    explicit hierarchy(const std::vector<config>& cfgs);
+
+    // accesses are aligned and never cross a line, so the size is not needed
+    void on_access(mem::address_t addr, size_t, mem::access kind) override
+    {
+        if (kind == mem::access::fetch) {
+            _pc = addr;
+            _l1i->access(addr, false, addr);
+        } else {
+            _l1d->access(addr, kind == mem::access::write, _pc);
+        }
+    }
+
+    const std::vector<std::unique_ptr<level>>& levels() const { return _levels; }
+
+    void reset_stats();
+    void report(std::ostream& os, const mem::memory& mem) const;
+};
+
+// "l1i=32k:8:64:lru:wb,l1d=...,l2=..." with size:assoc:line:policy:write,
+// an empty spec is the default hierarchy; exits on malformed specs
+std::vector<config> parse(const std::string& spec);
+
+} // namespace cache
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <memory.hh>
+
+namespace prof {
+
+// Shadow call stack built from jal/jalr. Calls are jumps that link into ra
+// (x1) or t0 (x5) and returns are jalr x0 through one of them, as in the
+// RISC-V psABI. Every distinct call path is a node of a tree, and retired
+// instructions are charged to the current node only when the stack changes,
+// so the cost per instruction is zero.
+class callstack {
+  private:
+    struct node {
+        mem::address_t _func;
+        uint32_t _parent;
+        uint64_t _self; // retired instructions in this path, callees excluded
+    };
+
+    struct frame {
+        uint32_t _node;
+        mem::address_t _return_address;
+    };
+
+    std::vector<node> _nodes;
+    std::vector<frame> _stack;
+    // (parent node, callee) -> child node
+    std::unordered_map<uint64_t, uint32_t> _children;
+    uint64_t _last_retired;
+
+    void charge(uint64_t retired);
+    uint32_t child(uint32_t parent, mem::address_t func);
+
+  public:
+    explicit callstack(mem::address_t entry);
+
+    static constexpr bool is_link(uint8_t reg) { return reg == 1 || reg == 5; }
+
+    // jal/jalr retired at pc towards target; retired includes the jump
+    void on_jump(uint32_t bitstream, mem::address_t pc, mem::address_t target,
+            uint64_t retired);
+
+    size_t depth() const { return _stack.size(); }
+
+    // folded stacks: "main;factorial;factorial 42" per line
+    void write_folded(std::ostream& os, const mem::memory& mem, uint64_t retired);
+};
+
+} // namespace prof
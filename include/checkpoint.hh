@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <memory.hh>
+#include <processor.hh>
+
+// Lightweight architectural checkpoints. The memory image is a list of
+// pages per segment held by shared pointers: a page that is not dirty is
+// shared with the previous checkpoint, so a checkpoint only copies the
+// pages written in between.
+namespace ckpt {
+
+using mem::page_size;
+
+using page = std::vector<uint8_t>;
+
+struct checkpoint {
+    uint64_t _retired;
+    mem::address_t _pc;
+    std::array<uint32_t, 32> _regs;
+    std::vector<mem::address_t> _bases; // initial address per segment
+    std::vector<bool> _mapped; // per segment, created by the guest with mmap
+    std::vector<std::vector<std::shared_ptr<const page>>> _pages; // per segment
+};
+
+// checkpoint of the current state, sharing the clean pages with prev, which
+// must be the last checkpoint taken of mem. Clears the dirty pages.
+checkpoint take(mem::memory& mem, const processor& proc, uint64_t retired,
+        const checkpoint* prev);
+
+// overwrite the state of proc and mem, which must come from the same binary;
+// engines holding decoded code of mem must be flushed
+void restore(const checkpoint& c, mem::memory& mem, processor& proc);
+
+} // namespace ckpt
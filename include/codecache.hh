@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <instructions.hh>
+#include <ir.hh>
+#include <memory.hh>
+
+// Persistent code cache. The block engine writes the blocks it decoded,
+// with their optimised IR and superblocks, to <dir>/<key>.rvcc when the run
+// ends; the next run of the same code maps the file and starts with them.
+// The key hashes the executable segments, the instruction set and the
+// format of the cache, so a file never applies to other code, to code run
+// with other legal instructions or to a simulator with another IR.
+namespace codecache {
+
+constexpr uint32_t version = 4;
+
+uint64_t key(const mem::memory& mem, const instrs::features& f);
+
+std::string path(const std::string& dir, const mem::memory& mem, const instrs::features& f);
+
+// a block as stored
+struct record {
+    mem::address_t _pc;
+    std::vector<uint32_t> _bitstreams;
+    std::unique_ptr<ir::block> _code; // nullptr when it has no lowering
+    std::unique_ptr<ir::block> _superblock;
+    std::vector<ir::step> _path; // blocks the superblock runs through
+};
+
+class writer {
+  private:
+    std::vector<uint8_t> _out;
+    uint64_t _records;
+
+  public:
+    writer();
+
+    void add(mem::address_t pc, const std::vector<uint32_t>& bitstreams,
+            const ir::block* code, const ir::block* superblock, const std::vector<ir::step>& path);
+
+    // replaces the file at once, concurrent runs see the old or the new one
+    void save(const std::string& file, const mem::memory& mem, const instrs::features& f) const;
+};
+
+// The mapped file of an earlier run, empty when there is none for this
+// code. Records are parsed on demand from the mapping.
+class reader {
+  private:
+    std::unique_ptr<mem::mapping> _map;
+    size_t _pos;
+    uint64_t _left;
+
+  public:
+    reader(const std::string& file, const mem::memory& mem, const instrs::features& f);
+
+    // false at the end, or at the first malformed record
+    bool next(record& r);
+};
+
+} // namespace codecache
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ir.hh>
+
+// Background compilation for the block engine. Lowering and optimising the
+// IR of a block or superblock is queued to worker threads while the guest
+// goes on with the per-instruction handlers; the result is published with
+// an atomic pointer the engine polls before each run of the block.
+namespace engine {
+
+class compilation {
+  private:
+    std::vector<ir::step> _steps;
+    std::atomic<ir::block*> _code;
+
+  public:
+    explicit compilation(std::vector<ir::step> steps) : _steps(std::move(steps)), _code(nullptr) {}
+    // code compiled earlier, published at once
+    explicit compilation(std::unique_ptr<ir::block> code) : _steps(), _code(code.release()) {}
+    ~compilation() { delete _code.load(std::memory_order_acquire); }
+
+    compilation(const compilation&) = delete;
+    compilation& operator=(const compilation&) = delete;
+
+    // the optimised IR, nullptr until published or if it has no lowering
+    const ir::block* code() const { return _code.load(std::memory_order_acquire); }
+
+    // lower, optimise and publish, once
+    void run();
+};
+
+class compiler {
+  private:
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::deque<std::shared_ptr<compilation>> _queue;
+    bool _stop;
+    std::vector<std::thread> _workers;
+
+    void work();
+
+  public:
+    explicit compiler(unsigned threads);
+    ~compiler();
+
+    compiler(const compiler&) = delete;
+    compiler& operator=(const compiler&) = delete;
+
+    // compilations nobody else holds any more, like the blocks of a flushed
+    // engine, are dropped without running
+    void submit(std::shared_ptr<compilation> c);
+};
+
+} // namespace engine
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <analysis.hh>
+#include <aot.hh>
+#include <bpred.hh>
+#include <callstack.hh>
+#include <codecache.hh>
+#include <compiler.hh>
+#include <instructions.hh>
+#include <intercept.hh>
+#include <ir.hh>
+#include <memory.hh>
+#include <processor.hh>
+#include <sampler.hh>
+#include <timing.hh>
+
+// Execution engines. Both run on the same processor and memory, so
+// switching engines between two calls keeps the architectural state.
+namespace engine {
+
+using handler = uint32_t (*)(mem::memory&, processor&, uint32_t);
+
+// emulation routine of the opcode of a bitstream
+using decoder = handler (*)(uint32_t);
+
+// decoder of the handlers instantiated for f
+decoder select(const instrs::features& f);
+
+// limit: max instructions retired, deadline: the stop flag was raised
+enum class status { halted, limit, deadline };
+
+struct result {
+    status _status;
+    uint64_t _retired; // instructions retired by this call
+    mem::address_t _pc; // of the halting instruction, or the next one to run
+};
+
+// Wall-clock limit for a run: a timer thread raises the flag when the time
+// is up and the engines poll it at block boundaries.
+class deadline {
+  private:
+    std::atomic<bool> _expired;
+    std::mutex _lock;
+    std::condition_variable _cancel;
+    bool _done;
+    std::thread _timer;
+
+  public:
+    explicit deadline(std::chrono::duration<double> limit);
+    ~deadline();
+
+    deadline(const deadline&) = delete;
+    deadline& operator=(const deadline&) = delete;
+
+    const std::atomic<bool>& flag() const { return _expired; }
+};
+
+// models driven by the reference loop after every instruction, all optional;
+// the memory observers (caches, ...) are attached to the memory instead
+struct models {
+    prof::callstack* _calls = nullptr;
+    prof::sampler* _sampler = nullptr;
+    prof::pc_counts* _counts = nullptr;
+    analysis::dispatcher* _events = nullptr;
+    bpred::simulator* _branches = nullptr;
+    timing::pipeline* _pipeline = nullptr;
+    intercept::table* _natives = nullptr; // seen by the models as a ret
+    const std::atomic<bool>* _stop = nullptr; // polled on control transfers
+    bool _verbose = false; // print every fetch
+    instrs::features _features; // _observed follows the memory
+};
+
+// Reference loop: fetch, dispatch and run the models one instruction at a
+// time, for at most max instructions or until the guest halts in a
+// while(1). retired is the running count of the whole execution.
+result run_reference(mem::memory& mem, processor& proc, const models& m,
+        uint64_t& retired, uint64_t max);
+
+// Fast functional engine. Basic blocks are decoded once into arrays of
+// handlers and executed without fetching or dispatching through a map.
+// With memory observers attached, like caches, every block runs on the
+// handlers, which notify them of the fetches and accesses.
+class block_engine {
+  private:
+    constexpr static size_t max_block = 64;
+    constexpr static size_t lookup_size = 4096;
+    constexpr static uint32_t hot = 64; // backward transfers before tracing
+    constexpr static size_t max_trace = 256; // instructions in a superblock
+
+    struct decoded {
+        handler _fn;
+        uint32_t _bitstream;
+    };
+
+    struct block {
+        mem::address_t _pc;
+        std::vector<decoded> _instrs;
+        const intercept::routine* _native = nullptr; // run natively instead
+        aot::block_fn _compiled = nullptr; // translated ahead of time
+        std::shared_ptr<compilation> _ir; // optimised, once compiled
+
+        // loop heads: backward transfers seen to the block, and once hot the
+        // superblock of the path the next iteration took
+        uint32_t _heat = 0;
+        bool _traced = false;
+        std::shared_ptr<compilation> _superblock;
+        std::vector<ir::step> _path; // the blocks it runs through, as decoded
+
+        // self loop without stores, syscalls or indirect jumps: an
+        // iteration only changes the registers in _writes
+        bool _loop = false;
+        uint32_t _writes = 0;
+        // every write is an addi r, r, step and the branch compares one of
+        // those registers with one the loop does not write
+        bool _affine = false;
+        std::vector<std::pair<uint8_t, uint32_t>> _steps;
+    };
+
+    constexpr static uint64_t unknown = 0;
+    constexpr static uint64_t forever = ~static_cast<uint64_t>(0);
+
+    std::unordered_map<mem::address_t, std::unique_ptr<block>> _blocks;
+    std::array<block*, lookup_size> _lookup; // direct-mapped cache in front of _blocks
+    intercept::table* _natives;
+    const aot::module* _translation; // dropped once the code is written
+    std::unordered_set<mem::address_t> _rewritten; // words the translation no longer matches
+    const std::atomic<bool>* _stop; // polled before every block
+    bool _endless; // halt in loops that can never exit
+    compiler* _compiler; // nullptr compiles on the calling thread
+    prof::sampler* _sampler; // the blocks publish where they are when set
+    prof::pc_counts* _counts;
+    uint64_t _skipped; // instructions retired without running them
+    uint64_t _translated; // instructions run by translated blocks
+    std::vector<block*> _trace; // blocks run since a hot head, while tracing
+    size_t _trace_length;
+    uint64_t _superblocks;
+    instrs::features _features; // _observed follows the memory
+    instrs::features _decoded; // configuration of the decoded blocks
+    decoder _decode;
+
+    // decode for the features and the observers of mem, dropping the
+    // blocks decoded for others
+    void configure_for(const mem::memory& mem);
+
+    // drop the blocks and superblocks over the code stores to mem wrote
+    void invalidate(mem::memory& mem);
+
+    block* translate(mem::memory& mem, mem::address_t pc);
+    static void analyse(block& b);
+
+    // b ran next while tracing: close the trace at its head or give up
+    void extend_trace(block* b);
+
+    std::shared_ptr<compilation> compile(std::vector<ir::step> steps);
+
+    // count the first n instructions of a run of b, or of its superblock
+    void count(const block& b, bool super, uint64_t n);
+
+    // iterations of an affine loop until it exits, counting the current
+    // one, forever if it never does or unknown
+    static uint64_t iterations(const block& b, const processor& proc);
+
+    block* find(mem::memory& mem, mem::address_t pc)
+    {
+        block*& b = _lookup[(pc >> 2) % lookup_size];
+        if (b == nullptr || b->_pc != pc) {
+            b = translate(mem, pc);
+        }
+        return b;
+    }
+
+  public:
+    explicit block_engine(intercept::table* natives = nullptr,
+            const aot::module* translation = nullptr) :
+        _blocks(), _lookup(), _natives(natives), _translation(translation), _rewritten(),
+        _stop(nullptr), _endless(true), _compiler(nullptr), _sampler(nullptr), _counts(nullptr),
+        _skipped(0), _translated(0), _trace(), _trace_length(0),
+        _superblocks(0), _features(), _decoded(), _decode(select(_decoded)) {}
+
+    void configure(const instrs::features& f) { _features = f; }
+    void stop_on(const std::atomic<bool>* flag) { _stop = flag; }
+    void compile_on(compiler* c) { _compiler = c; }
+    void halt_endless(bool on) { _endless = on; }
+    void profile_on(prof::sampler* s, prof::pc_counts* counts) { _sampler = s; _counts = counts; }
+
+    // Loops that can never exit halt the guest like a while(1), unless
+    // halt_endless is off, and affine loops are advanced to their last
+    // iteration at once, with retired counting the instructions they would
+    // have run. Loops of several
+    // blocks run as one superblock per iteration once their head is hot.
+    result run(mem::memory& mem, processor& proc, uint64_t& retired, uint64_t max);
+
+    uint64_t skipped() const { return _skipped; }
+    uint64_t translated() const { return _translated; }
+    uint64_t superblocks() const { return _superblocks; }
+
+    // forget every decoded block
+    void flush();
+
+    // Persistent code cache: start with the blocks of an earlier run of the
+    // code in mem, returning how many, and store the blocks decoded so far.
+    // Blocks are only loaded without natives or a translation, which decide
+    // where blocks start.
+    size_t load(codecache::reader& in, mem::memory& mem);
+    void save(codecache::writer& out) const;
+};
+
+} // namespace engine
@@ -116,18 +116,39 @@ inline T sign_extend(const T x)
     return s.x = x;
 }
 
-template<uint8_t funct3>
-void execute_load(mem::memory& mem, processor& proc,
-    mem::address_t addr, uint8_t rd);
+// Features of the handlers, fixed for a run of an engine. Every combination
+// is instantiated ahead of time and the engines pick one when they start,
+// so a feature that is off costs nothing instead of a test in the handlers.
+struct features {
+    bool _observed = true;  // loads and stores notify the memory observers
+    bool _rv32m = true;     // mul decodes, otherwise it is illegal
+    bool _alignment = true; // misaligned loads and stores stop the run
+
+    constexpr bool operator==(const features&) const = default;
+};
+
+// the combinations, numbered by their bits
+constexpr size_t configurations = 8;
+
+constexpr features configuration(size_t i)
+{
+    return features{(i & 4) != 0, (i & 2) != 0, (i & 1) != 0};
+}
 
-template<uint8_t funct3>
-void execute_store(mem::memory& mem, processor& proc,
-    mem::address_t addr, uint8_t rs2);
+constexpr size_t index(const features& f)
+{
+    return (f._observed ? 4 : 0) | (f._rv32m ? 2 : 0) | (f._alignment ? 1 : 0);
+}
+
+// name of the emulation routine handling an opcode, for reports
+const char* opcode_name(uint8_t opcode);
 
 using instr_emulation = std::function<uint32_t(mem::memory& mem, processor& proc, uint32_t)>;
 
-// Operaciones de memoria
+// Operaciones de memoria, instantiated for every configuration
+template<features F>
 uint32_t load(mem::memory& mem, processor& proc, uint32_t bitstream);
+template<features F>
 uint32_t store(mem::memory& mem, processor& proc, uint32_t bitstream);
 
 // Operación alu con inmediato
@@ -142,7 +163,13 @@ uint32_t lui(mem::memory&, processor& proc, uint32_t bitstream);
 // jump and link
 uint32_t jal(mem::memory&, processor& proc, uint32_t bitstream);
 
+// jump and link register
+uint32_t jalr(mem::memory&, processor& proc, uint32_t bitstream);
+
 // branch
 uint32_t condbranch(mem::memory&, processor& proc, uint32_t bitstream);
 
+// system: ecall and the Zicntr counter reads, through the replay environment
+uint32_t system(mem::memory& mem, processor& proc, uint32_t bitstream);
+
 } // namespace instrs
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include <memory.hh>
+#include <processor.hh>
+
+// Host-native versions of hot libc routines. Their entry points are taken
+// from the ELF symbol table and, when the guest pc reaches one, the engines
+// run the host routine on guest memory and return through ra instead of
+// executing the guest code.
+namespace intercept {
+
+enum class routine : uint8_t { memcpy, memset, strlen, strcmp };
+
+constexpr size_t routines = 4;
+
+const char* routine_name(routine r);
+
+// instructions a native call retires: one, as really executed, or an
+// estimate of the guest code it replaces
+enum class accounting { real, estimate };
+
+// "real" or "estimate", exits otherwise
+accounting parse(const std::string& spec);
+
+// the return the native call stands for, as seen by the models
+constexpr uint32_t ret = 0x00008067; // jalr x0, 0(ra)
+
+// the same return writing the result, as recorded in traces, whose readers
+// only see the registers written by the records
+constexpr uint32_t ret_a0 = 0x00008567; // jalr a0, 0(ra)
+
+class table {
+  private:
+    constexpr static size_t filter_size = 4096;
+
+    std::unordered_map<mem::address_t, routine> _entries;
+    std::bitset<filter_size> _filter; // quick reject by pc, before the map
+    accounting _accounting;
+    std::array<uint64_t, routines> _calls;
+    std::array<uint64_t, routines> _bytes;
+    std::array<uint64_t, routines> _retired;
+
+    uint64_t retires(routine r, size_t bytes) const;
+
+  public:
+    // resolves the routines present in the symbols of mem
+    table(const mem::memory& mem, accounting a);
+
+    bool empty() const { return _entries.empty(); }
+
+    // routine with its entry at pc, or nullptr
+    const routine* find(mem::address_t pc) const
+    {
+        if (!_filter[(pc >> 2) % filter_size]) {
+            return nullptr;
+        }
+        auto it = _entries.find(pc);
+        return it == _entries.end() ? nullptr : &it->second;
+    }
+
+    // instructions call would retire; the engines run the guest code
+    // instead when they are more than the budget left
+    uint64_t cost(routine r, const mem::memory& mem, const processor& proc) const;
+
+    // run r on the arguments in the registers and return to ra, the pc is
+    // left at ra; returns the instructions to retire
+    uint64_t call(routine r, mem::memory& mem, processor& proc);
+
+    void report(std::ostream& os) const;
+};
+
+} // namespace intercept
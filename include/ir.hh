@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <memory.hh>
+#include <processor.hh>
+
+// Block-level IR. A basic block is lowered into a list of nodes in SSA
+// form: every node producing a value is numbered by its position and only
+// uses values of earlier nodes. Registers are read once per block and
+// written back with set nodes, so the passes can drop the spills, reloads
+// and constants -O0 code recomputes. The IR leaves memory accesses out when
+// their value is known, so it only runs when no observer watches memory.
+namespace ir {
+
+enum class op : uint8_t {
+    constant, // _imm
+    get,      // register _reg, as the block or the last system node left it
+    addi,     // _a + _imm
+    shli,     // _a << _imm
+    add,      // _a + _b
+    sub,      // _a - _b
+    mul,      // _a * _b
+    extend,   // low _size bytes of _a, sign extended if _signed
+    load,     // _size bytes at _a, extended like extend, by the _index-th
+              // instruction at _pc; leaves the block before a misaligned one
+    store,    // low _size bytes of _b at _a, like load; also leaves the block
+              // after a store to decoded code
+    set,      // register _reg = _a
+    system,   // system instruction _imm at _pc, after _index instructions,
+              // leaves the block like a store
+    guard,    // side exit to _imm when _a and _b compare as funct3 _cond,
+              // taken by the branch at _pc, the _index-th instruction
+    nop,      // removed by a pass
+};
+
+struct node {
+    op _op = op::nop;
+    uint8_t _reg = 0;
+    uint8_t _size = 0;
+    bool _signed = false;
+    uint8_t _cond = 0;
+    uint32_t _a = 0;
+    uint32_t _b = 0;
+    uint32_t _imm = 0;
+    mem::address_t _pc = 0;
+    uint32_t _index = 0;
+};
+
+// how the last instruction leaves the block
+enum class ending : uint8_t {
+    next,     // falls through to _next
+    jump,     // to _target
+    indirect, // to _a & ~1
+    branch,   // to _target if _a and _b compare as funct3 _cond, else _next
+};
+
+// what running a block returns: the next pc, or the pc of a halting
+// instruction, which jumps to itself, or of a misaligned access, left to
+// the handlers and their alignment checks
+struct outcome {
+    mem::address_t _next;
+    bool _halted;
+    bool _misaligned;
+};
+
+struct block {
+    mem::address_t _pc;
+    uint32_t _length; // instructions
+    std::vector<node> _nodes;
+
+    ending _ending = ending::next;
+    uint8_t _cond = 0;
+    uint32_t _a = 0;
+    uint32_t _b = 0;
+    mem::address_t _last = 0; // pc of the last instruction
+    mem::address_t _target = 0;
+    mem::address_t _next = 0;
+
+    mutable std::vector<uint32_t> _values; // scratch for run
+};
+
+// IR of the instructions at pc, nullptr if one of them has no lowering
+std::unique_ptr<block> lower(const std::vector<uint32_t>& bitstreams, mem::address_t pc);
+
+// a basic block a trace ran through
+struct step {
+    mem::address_t _pc;
+    std::vector<uint32_t> _bitstreams;
+};
+
+// Superblock of the basic blocks of a trace, in the order they ran: each
+// one goes on to the next and leaves through a guard where a branch would
+// go elsewhere. nullptr if a step does not lead to the next one, or if an
+// inner one ends with an indirect jump.
+std::unique_ptr<block> lower_trace(const std::vector<step>& steps);
+
+// Passes, each keeps the block valid; guards see every register and count
+// as a use of the values set before them
+void fold_constants(block& b);      // evaluate constant operations, drop identities
+void eliminate_common(block& b);    // reassociate address offsets, merge equal values
+void forward_memory(block& b);      // loads of stored or loaded bytes reuse the value
+void eliminate_writebacks(block& b); // sets overwritten before any node that may leave the block
+void eliminate_dead(block& b);      // unused values and nops, renumbering the rest
+
+// all of them, in order
+void optimise(block& b);
+
+// every operand names an earlier node, and the ops, sizes, registers,
+// shift amounts and ending are in range, as for blocks read back from a file
+bool valid(const block& b);
+
+// runs the block with no observer attached to mem, adding the instructions
+// it retires to retired
+outcome run(const block& b, mem::memory& mem, processor& proc, uint64_t& retired);
+
+} // namespace ir
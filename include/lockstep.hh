@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include <aot.hh>
+#include <compiler.hh>
+#include <engine.hh>
+#include <memory.hh>
+#include <processor.hh>
+#include <replay.hh>
+#include <syscalls.hh>
+
+// Lockstep differential execution. The reference loop runs the guest with
+// the models and the host inputs, and the block engine follows it on a
+// clone of the processor and memory, replaying the inputs the reference
+// took. After every step both have retired the same instructions, and the
+// pc, the registers, the pages written since the previous step and the exit
+// state must agree; the first step where they do not stops the run.
+namespace lockstep {
+
+enum class granularity {
+    instruction, // the block engine only runs its handlers, one at a time
+    block,    // up to the next taken control transfer of the reference
+    interval, // every _interval instructions
+    digest,   // every _interval instructions, a hash of the state per engine
+};
+
+struct params {
+    granularity _when;
+    uint64_t _interval;
+};
+
+// "instr", "block", "<N>" or "hash:<N>", exits on malformed specs
+params parse(const std::string& spec);
+
+class checker {
+  private:
+    params _params;
+    uint64_t _retired; // running count of the block engine
+    replay::environment _env;
+    sys::emulator _syscalls;
+    mem::memory _mem;
+    processor _proc;
+    engine::block_engine _blocks;
+    std::atomic<bool> _boundary; // always raised, stops the reference at transfers
+
+    bool _diverged;
+    uint64_t _agreed; // instructions retired at the last step both agreed on
+    mem::address_t _agreed_pc;
+    std::ostringstream _report;
+
+    // false and the differences in _report if the states disagree, clears
+    // the dirty pages of both
+    bool compare(mem::memory& mem, const processor& proc, const sys::emulator& syscalls,
+            const engine::result& ref, const engine::result& fast);
+
+  public:
+    // clones mem and proc, which must be at the start of the run
+    checker(const params& p, const mem::memory& mem, const processor& proc, uint64_t retired,
+            const aot::module* translation, engine::compiler* background);
+
+    checker(const checker&) = delete;
+    checker& operator=(const checker&) = delete;
+
+    // Run both engines from the current environment, which must record or
+    // replay, for at most max instructions. A divergence ends the run like a
+    // halt, with the reference stopped at the step that disagreed.
+    engine::result run(mem::memory& mem, processor& proc, const engine::models& m,
+            uint64_t& retired, uint64_t max);
+
+    bool diverged() const { return _diverged; }
+    void report(std::ostream& os) const;
+};
+
+} // namespace lockstep
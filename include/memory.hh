@@ -1,8 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstdint>
 #include <elf.h>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -10,13 +14,95 @@ namespace mem {
 
 using address_t = uint32_t;
 
+// granularity of the dirty and code tracking
+constexpr size_t page_bits = 12;
+constexpr size_t page_size = size_t(1) << page_bits;
+
+// host memory mapped with mmap, unmapped with the last segment using it
+struct mapping
+{
+    uint8_t* _addr;
+    size_t _length;
+
+    mapping(uint8_t* addr, size_t length) : _addr(addr), _length(length) {}
+    ~mapping();
+
+    mapping(const mapping&) = delete;
+    mapping& operator=(const mapping&) = delete;
+};
+
+// Guest memory range, held in _content or, for mmap'ed files, in a host
+// mapping paged in by the host kernel. Copies of a mapped segment share it.
 struct segment
 {
     address_t _initial_address;
     std::vector<uint8_t> _content;
+    std::shared_ptr<mapping> _map;
+    std::vector<uint64_t> _dirty; // one bit per page written since the last clear
+    std::vector<uint64_t> _code; // one bit per page holding decoded instructions
+    bool _mapped; // created by the guest with mmap, munmap may remove it
+
+    segment() : _initial_address(0), _content(), _map(), _dirty(), _code(), _mapped(false) {}
+    segment(address_t initial_address, size_t size) : _initial_address(initial_address),
+        _content(size), _map(), _dirty(bitmap_words(size)), _code(bitmap_words(size)), _mapped(false) {}
+    segment(address_t initial_address, std::shared_ptr<mapping> map) :
+        _initial_address(initial_address), _content(), _map(std::move(map)),
+        _dirty(bitmap_words(_map->_length)), _code(bitmap_words(_map->_length)), _mapped(false) {}
+
+    static size_t bitmap_words(size_t size) { return (((size + page_size - 1) >> page_bits) + 63) / 64; }
+
+    uint8_t* data() { return _map ? _map->_addr : _content.data(); }
+    const uint8_t* data() const { return _map ? _map->_addr : _content.data(); }
+    size_t size() const { return _map ? _map->_length : _content.size(); }
 
-    segment() : _initial_address(0), _content() {}
-    segment(address_t initial_address, size_t size) : _initial_address(initial_address), _content(size) {}
+    size_t pages() const { return (size() + page_size - 1) >> page_bits; }
+
+    // size the bitmaps after the content was filled directly
+    void reset_bitmaps()
+    {
+        _dirty.assign(bitmap_words(size()), 0);
+        _code.assign(bitmap_words(size()), 0);
+    }
+
+    // grow with zeros or shrink, keeping the bits of the remaining pages
+    void resize(size_t size)
+    {
+        assert(!_map);
+        _content.resize(size);
+        _dirty.resize(bitmap_words(size));
+        _code.resize(bitmap_words(size));
+        if (pages() % 64 != 0) {
+            uint64_t keep = (uint64_t(1) << (pages() % 64)) - 1;
+            _dirty.back() &= keep;
+            _code.back() &= keep;
+        }
+    }
+};
+
+// kind of access seen by an observer
+enum class access { fetch, read, write };
+
+// Notified of every instruction fetch and every data access, used by the
+// architectural models (caches, ...)
+class observer
+{
+  public:
+    virtual ~observer() = default;
+    virtual void on_access(address_t addr, size_t size, access kind) = 0;
+};
+
+// bytes written to a page holding decoded instructions
+struct code_write
+{
+    address_t _addr;
+    size_t _size;
+};
+
+struct symbol
+{
+    std::string _name;
+    address_t _address;
+    size_t _size;
 };
 
 class memory
@@ -26,13 +112,41 @@ class memory
     Elf32_Ehdr _ehdr; // ELF header
     std::vector<Elf32_Phdr> _phdr; // Program header table, may contain multiple entries
     std::vector<segment> _segments;
+    std::map<address_t, symbol> _symbols; // function symbols sorted by address
+    std::vector<observer*> _observers;
+    bool _code_written; // a page in some _code bitmap was written
+    std::vector<code_write> _code_writes; // the writes to those pages
+    bool _code_overflow; // too many to keep, or a segment went away
+
+    void load_symbols();
+
+    // mark the page holding pos dirty, true if it holds decoded code
+    bool touch(segment& seg, size_t pos)
+    {
+        size_t p = pos >> page_bits;
+        uint64_t bit = uint64_t(1) << (p & 63);
+        seg._dirty[p >> 6] |= bit;
+        return seg._code[p >> 6] & bit;
+    }
+
+    void wrote_code(address_t addr, size_t size)
+    {
+        _code_written = true;
+        if (_code_writes.size() < max_code_writes) {
+            _code_writes.push_back(code_write{addr, size});
+        } else {
+            _code_overflow = true;
+        }
+    }
 
   public:
 
     constexpr static size_t stack_top = 128 * 1024 * 1024; // the stack segment is always the first
     constexpr static size_t stack_size = 1024 * 1024; // the stack segment is always the first
+    constexpr static size_t max_code_writes = 64; // kept between two clear_code_writes
 
-    memory() : _binary(), _ehdr(), _phdr(), _segments() {
+    memory() : _binary(), _ehdr(), _phdr(), _segments(), _symbols(), _observers(), _code_written(false),
+        _code_writes(), _code_overflow(false) {
         // initialize the stack
         _segments.push_back(segment(stack_top-stack_size, stack_size)); // initial 1MB stack
     }
@@ -41,7 +155,7 @@ class memory
         size_t i = 0;
         for(; i < _segments.size(); ++i){
             auto begin = _segments[i]._initial_address;
-            auto end = begin + _segments[i]._content.size();
+            auto end = begin + _segments[i].size();
             if((begin <= addr) && (addr < end)) {
                 return static_cast<ssize_t>(i);
             }
@@ -49,8 +163,185 @@ class memory
         return -1;
     }
 
+  void attach(observer* o) { _observers.push_back(o); }
+  bool observed() const { return !_observers.empty(); }
+  void detach(observer* o) { std::erase(_observers, o); }
+  void detach_all() { _observers.clear(); }
+
+  // end of the highest loaded segment, the program break starts after it
+  address_t image_end() const
+  {
+    address_t end = 0;
+    for (const Elf32_Phdr& phdr : _phdr) {
+      if (phdr.p_type == PT_LOAD) {
+        end = std::max<address_t>(end, phdr.p_vaddr + phdr.p_memsz);
+      }
+    }
+    return end;
+  }
+
+  const std::vector<Elf32_Phdr>& program_headers() const { return _phdr; }
+
+  // Host pointer to [addr, addr + len), or nullptr when the range is not
+  // inside a single segment. Writes through it must be reported with
+  // mark_dirty. The pointer is valid until the segments change.
+  uint8_t* host_ptr(address_t addr, size_t len)
+  {
+    auto seg_idx = find_segment(addr);
+    if (seg_idx == -1) {
+      return nullptr;
+    }
+    segment& seg = _segments[seg_idx];
+    size_t pos = addr - seg._initial_address;
+    return len <= seg.size() - pos ? seg.data() + pos : nullptr;
+  }
+
+  size_t add_segment(address_t initial_address, size_t size)
+  {
+    _segments.push_back(segment(initial_address, size));
+    return _segments.size() - 1;
+  }
+
+  size_t add_segment(address_t initial_address, std::shared_ptr<mapping> map)
+  {
+    _segments.push_back(segment(initial_address, std::move(map)));
+    return _segments.size() - 1;
+  }
+
+  // decoded code in the segment counts as written
+  void remove_segment(size_t i)
+  {
+    for (uint64_t word : _segments[i]._code) {
+      if (word != 0) {
+        _code_written = true;
+        _code_overflow = true;
+      }
+    }
+    _segments.erase(_segments.begin() + static_cast<ssize_t>(i));
+  }
+
+  // raw segment contents, for checkpoints
+  const std::vector<segment>& segments() const { return _segments; }
+  std::vector<segment>& segments() { return _segments; }
+
+  // Dirty pages, set by every write and by mark_dirty for the host side
+  // writers. Iterating and clearing cost a scan of one bit per page.
+  bool dirty(address_t addr) const
+  {
+    auto seg_idx = find_segment(addr);
+    assert(seg_idx != -1);
+    const segment& seg = _segments[seg_idx];
+    size_t p = (addr - seg._initial_address) >> page_bits;
+    return (seg._dirty[p >> 6] >> (p & 63)) & 1;
+  }
+
+  void mark_dirty(address_t addr, size_t size)
+  {
+    auto seg_idx = find_segment(addr);
+    assert(seg_idx != -1 && size > 0);
+    segment& seg = _segments[seg_idx];
+    size_t pos = addr - seg._initial_address;
+    assert(pos + size <= seg.size());
+    bool code = false;
+    for (size_t p = pos >> page_bits; p <= (pos + size - 1) >> page_bits; ++p) {
+      code |= touch(seg, p << page_bits);
+    }
+    if (code) {
+      wrote_code(addr, size);
+    }
+  }
+
+  // f(segment index, page index) for every dirty page, in address order
+  // within a segment
+  template<typename F>
+  void for_each_dirty(F f) const
+  {
+    for (size_t s = 0; s < _segments.size(); ++s) {
+      const auto& bits = _segments[s]._dirty;
+      for (size_t w = 0; w < bits.size(); ++w) {
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+          f(s, w * 64 + std::countr_zero(word));
+        }
+      }
+    }
+  }
+
+  size_t dirty_pages() const
+  {
+    size_t n = 0;
+    for (const segment& seg : _segments) {
+      for (uint64_t word : seg._dirty) {
+        n += std::popcount(word);
+      }
+    }
+    return n;
+  }
+
+  void clear_dirty()
+  {
+    for (segment& seg : _segments) {
+      std::fill(seg._dirty.begin(), seg._dirty.end(), 0);
+    }
+  }
+
+  // Pages holding decoded instructions: the block engine marks them and
+  // drops the blocks over the ranges code_writes() reports stored to.
+  void mark_code(address_t addr)
+  {
+    auto seg_idx = find_segment(addr);
+    assert(seg_idx != -1);
+    segment& seg = _segments[seg_idx];
+    size_t p = (addr - seg._initial_address) >> page_bits;
+    seg._code[p >> 6] |= uint64_t(1) << (p & 63);
+  }
+
+  bool code_written() const { return _code_written; }
+
+  // the writes since the last clear, nullptr if they were too many to keep
+  const std::vector<code_write>* code_writes() const
+  {
+    return _code_overflow ? nullptr : &_code_writes;
+  }
+
+  // forget the writes, keeping the code pages
+  void clear_code_writes()
+  {
+    _code_writes.clear();
+    _code_overflow = false;
+    _code_written = false;
+  }
+
+  void clear_code()
+  {
+    for (segment& seg : _segments) {
+      std::fill(seg._code.begin(), seg._code.end(), 0);
+    }
+    clear_code_writes();
+  }
+
+  void notify(address_t addr, size_t size, access kind)
+  {
+    for (observer* o : _observers) {
+      o->on_access(addr, size, kind);
+    }
+  }
+
   template<typename T>
   T read(address_t addr)
+  {
+    notify(addr, sizeof(T), access::read);
+    return peek<T>(addr);
+  }
+
+  uint32_t fetch(address_t pc)
+  {
+    notify(pc, sizeof(uint32_t), access::fetch);
+    return peek<uint32_t>(pc);
+  }
+
+  // read without notifying the observers
+  template<typename T>
+  T peek(address_t addr) const
   {
     // find the segment
     auto seg_idx = find_segment(addr);
@@ -61,11 +352,38 @@ class memory
     // ensure alignment
     assert ((pos & (sizeof(T) - 1)) == 0);
 
-    return *reinterpret_cast<T*>(&_segments[seg_idx]._content[pos]);
+    return *reinterpret_cast<const T*>(_segments[seg_idx].data() + pos);
+  }
+
+  // byte by byte, for accesses that may be misaligned or span two segments
+  template<typename T>
+  T peek_misaligned(address_t addr) const
+  {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      value |= static_cast<T>(static_cast<uint32_t>(peek<uint8_t>(addr + static_cast<address_t>(i))) << (8 * i));
+    }
+    return value;
+  }
+
+  template<typename T>
+  void poke_misaligned(address_t addr, T value)
+  {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      poke<uint8_t>(addr + static_cast<address_t>(i), static_cast<uint8_t>(value >> (8 * i)));
+    }
   }
 
   template<typename T>
   void write(address_t addr, T value)
+    {
+      notify(addr, sizeof(T), access::write);
+      poke<T>(addr, value);
+    }
+
+  // write without notifying the observers
+  template<typename T>
+  void poke(address_t addr, T value)
     {
       // find the segment
       auto seg_idx = find_segment(addr);
@@ -77,15 +395,25 @@ class memory
       assert ((pos & (sizeof(T) - 1)) == 0);
 
       for(size_t i = 0; i < sizeof(T); ++i) {
-        _segments[seg_idx]._content[pos+i]=value & 0xFF;
+        _segments[seg_idx].data()[pos+i]=value & 0xFF;
         value = value >> 8;
       }
+      // aligned, so it never spans two pages
+      if (touch(_segments[seg_idx], pos)) {
+        wrote_code(addr, sizeof(T));
+      }
     }
 
         void load_binary(const std::string& binfile);
         void dump_hex(size_t segment_id) const;
 
   address_t entry_point() const { return _ehdr.e_entry; }
+
+  // name of the function containing addr, or its hex address if unknown
+  std::string symbol_name(address_t addr) const;
+
+  // function symbol called name, or nullptr
+  const symbol* find_symbol(const std::string& name) const;
 };
 
 } // namespace mem
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <cache.hh>
+#include <checkpoint.hh>
+#include <replay.hh>
+#include <timing.hh>
+
+// Parallel interval simulation. The block engine runs the guest and drops a
+// checkpoint every K instructions; worker threads replay the intervals
+// between checkpoints under the detailed models (pipeline and caches) and
+// their statistics are added up at the end. With W > 0 an interval is
+// replayed from the previous checkpoint and its last W instructions warm the
+// models before measuring. The functional pass records the host inputs and
+// the workers replay them, so they never redo any I/O.
+namespace parallel {
+
+struct params {
+    uint64_t _interval;
+    uint64_t _warm;
+    unsigned _threads;
+};
+
+// "K[:W]", exits on malformed specs
+params parse(const std::string& spec);
+
+class interval_simulation {
+  private:
+    struct result {
+        timing::stats _timing;
+        std::vector<cache::stats> _caches;
+    };
+
+    params _params;
+    timing::config _timing;
+    std::vector<cache::config> _caches;
+    mem::memory _base; // loaded image the workers start from
+
+    std::mutex _lock;
+    std::condition_variable _ready;
+    std::vector<std::shared_ptr<const ckpt::checkpoint>> _checkpoints;
+    std::vector<replay::environment::cursor> _cursors; // log position at each checkpoint
+    std::vector<std::shared_ptr<const std::vector<uint8_t>>> _logs; // inputs per interval
+    size_t _next;
+    bool _done;
+    std::vector<result> _results;
+
+    void worker();
+
+  public:
+    // caches may be empty to simulate the pipeline alone
+    interval_simulation(const params& p, const timing::config& timing,
+            const std::vector<cache::config>& caches, const mem::memory& base);
+
+    // functional pass plus the workers, until the guest halts; the current
+    // environment must be recording or replaying
+    void run(mem::memory& mem, processor& proc, uint64_t& retired);
+
+    void report(std::ostream& os) const;
+};
+
+} // namespace parallel
@@ -1,7 +1,6 @@
 #pragma once
 
 #include <array>
-#include <cassert>
 #include <cstdint>
 #include <cstddef>
 
@@ -10,9 +9,19 @@ class processor {
 
   private:
   constexpr static size_t num_regs = 32;
-  std::array<uint32_t, num_regs> _reg_file;
+  constexpr static size_t sink = num_regs; // takes the writes to x0, never read
+  // slot 0 always holds zero, so reads of x0 need no test either
+  std::array<uint32_t, num_regs + 1> _reg_file;
   uint32_t _pc;
 
+  // Slot written for register i: the index is masked to 5 bits like the
+  // register fields, and x0 goes to the sink without a branch
+  constexpr static size_t slot(size_t i)
+  {
+   i &= num_regs - 1;
+   return i | (static_cast<size_t>(i == 0) * sink);
+  }
+
   public:
   constexpr static size_t sp = 2;
 
@@ -23,9 +32,8 @@ class processor {
    }
   }
 
-  // FIXME use contracts C++20
-  constexpr uint32_t read_reg(size_t i) const { assert(i<32); return _reg_file[i]; }
-  void write_reg(size_t i, uint32_t val) { assert(i<32); if(i>0) { _reg_file[i] = val; } }
+  constexpr uint32_t read_reg(size_t i) const { return _reg_file[i & (num_regs - 1)]; }
+  void write_reg(size_t i, uint32_t val) { _reg_file[slot(i)] = val; }
 
   constexpr uint32_t read_pc() const { return _pc; }
   uint32_t next_pc() { _pc+=4; return _pc; }
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Record and replay of the non-deterministic inputs of the guest. Every
+// value the guest obtains from the host (counters, syscall results, input
+// data) goes through the environment: live runs ask the host, recording
+// runs also append the value to the log, and replays take it back from
+// the log without touching the host.
+//
+// Log entry: varint instruction count since the previous entry, kind byte,
+// then a varint value, or a varint length and the data bytes.
+namespace replay {
+
+enum class mode { live, record, replay };
+
+// what an entry holds, checked on replay to catch divergences
+enum class input : uint8_t { cycle, time, syscall, data };
+
+class environment {
+  public:
+    // position in the log, to resume a replay from a checkpoint
+    struct cursor {
+        size_t _pos;
+        uint64_t _last; // instruction count of the previous entry
+    };
+
+  private:
+    static thread_local environment* _current;
+
+    mode _mode;
+    const uint64_t& _retired;
+    std::vector<uint8_t> _log;
+    cursor _cursor;
+    std::chrono::steady_clock::time_point _start;
+    uint64_t _entries; // recorded
+
+    void append(input k, uint64_t v);
+    void append(input k, const uint8_t* data, size_t len);
+    uint64_t take(input k);
+    size_t take(input k, uint8_t* data, size_t len);
+
+  public:
+    // retired is the running instruction count of the engines
+    environment(mode m, const uint64_t& retired);
+
+    // environment of the instructions executed by this thread
+    static environment& current();
+    void make_current() { _current = this; }
+
+    mode get_mode() const { return _mode; }
+    uint64_t retired() const { return _retired; }
+    uint64_t entries() const { return _entries; }
+    size_t bytes() const { return _log.size(); }
+
+    // nanoseconds since the environment was created
+    uint64_t host_clock() const;
+
+    template<typename F>
+    uint64_t value(input k, F host)
+    {
+        if (_mode == mode::replay) {
+            return take(k);
+        }
+        uint64_t v = host();
+        if (_mode == mode::record) {
+            append(k, v);
+        }
+        return v;
+    }
+
+    // up to len bytes into data, host(data, len) returns how many it wrote
+    template<typename F>
+    size_t data(input k, uint8_t* data, size_t len, F host)
+    {
+        if (_mode == mode::replay) {
+            return take(k, data, len);
+        }
+        size_t n = host(data, len);
+        if (_mode == mode::record) {
+            append(k, data, n);
+        }
+        return n;
+    }
+
+    cursor position() const { return _cursor; }
+
+    // switch a recorded run to replaying its own log from c
+    void rewind(const cursor& c);
+
+    // log entries between two positions
+    std::vector<uint8_t> slice(const cursor& from, const cursor& to) const
+    {
+        return std::vector<uint8_t>(_log.begin() + from._pos, _log.begin() + to._pos);
+    }
+
+    // replay entries taken from another log, the first one following
+    // instruction last
+    void replay_log(std::vector<uint8_t> log, uint64_t last);
+
+    // replay the log of a file, from the start
+    void load(const std::string& file);
+    void save(const std::string& file) const;
+
+    // true once a replay consumed the whole log
+    bool exhausted() const { return _cursor._pos == _log.size(); }
+};
+
+} // namespace replay
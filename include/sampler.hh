@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <memory.hh>
+
+namespace prof {
+
+// execution tier running the guest when a sample is taken
+enum class tier : uint8_t {
+    interpreter, // the reference loop
+    blocks,      // the handlers of a decoded block
+    ir,          // the optimised IR of a block or superblock
+    compiled,    // a block translated ahead of time
+    native,      // an intercepted routine
+};
+
+const char* tier_name(tier t);
+
+// retired instructions per guest pc, stored in pages of 1024 instructions
+// so the hot path is an increment through a cached page pointer
+class pc_counts {
+  private:
+    constexpr static size_t page_bits = 10;
+    constexpr static mem::address_t no_page = ~static_cast<mem::address_t>(0);
+
+    std::unordered_map<mem::address_t, std::vector<uint64_t>> _pages;
+    mem::address_t _last_page;
+    uint64_t* _last;
+
+  public:
+    pc_counts() : _pages(), _last_page(no_page), _last(nullptr) {}
+
+    void add(mem::address_t pc, uint64_t n = 1)
+    {
+        mem::address_t page = pc >> (page_bits + 2);
+        if (page != _last_page) {
+            auto& counts = _pages[page];
+            counts.resize(1 << page_bits);
+            _last_page = page;
+            _last = counts.data();
+        }
+        _last[(pc >> 2) & ((1 << page_bits) - 1)] += n;
+    }
+
+    uint64_t at(mem::address_t pc) const;
+};
+
+// Host-time sampling profiler. A CPU-time timer raises SIGPROF and the
+// handler copies the guest state published by the engines into a
+// lock-free ring, which is drained outside of the handler. Signal handlers
+// are process-wide, so there is at most one sampler alive.
+class sampler {
+  private:
+    constexpr static size_t ring_size = 1 << 16;
+
+    // pc | opcode << 32 | tier << 40
+    static std::atomic<uint64_t> _current;
+    static std::array<uint64_t, ring_size> _ring;
+    static std::atomic<size_t> _head; // only written by the handler
+    static std::atomic<size_t> _tail; // only written by drain
+    static std::atomic<size_t> _dropped;
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+    static_assert(std::atomic<size_t>::is_always_lock_free);
+
+    unsigned _hz;
+    timer_t _timer;
+    struct sigaction _old_action;
+    std::unordered_map<uint64_t, uint64_t> _samples;
+
+    static void on_tick(int);
+
+  public:
+    explicit sampler(unsigned hz);
+    ~sampler();
+
+    sampler(const sampler&) = delete;
+    sampler& operator=(const sampler&) = delete;
+
+    static void publish(mem::address_t pc, uint8_t opcode, tier t)
+    {
+        _current.store(pc | (static_cast<uint64_t>(opcode) << 32)
+                | (static_cast<uint64_t>(t) << 40), std::memory_order_relaxed);
+    }
+
+    // move the samples out of the ring, call it often enough not to drop
+    void drain();
+
+    void report(std::ostream& os, const mem::memory& mem, const pc_counts& counts,
+            uint64_t retired);
+};
+
+} // namespace prof
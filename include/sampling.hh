@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cache.hh>
+#include <engine.hh>
+#include <timing.hh>
+
+// SMARTS-style sampled simulation: fast-forward N instructions with the
+// block engine, warm the detailed models for W instructions and measure the
+// next M, over and over until the guest halts. The metrics of the whole run
+// are extrapolated from the samples with confidence intervals.
+namespace sampling {
+
+struct params {
+    uint64_t _fast;
+    uint64_t _warm;
+    uint64_t _measure;
+};
+
+// "N:W:M", exits on malformed specs
+params parse(const std::string& spec);
+
+// mean and confidence interval of a per-sample metric
+class estimator {
+  private:
+    std::vector<double> _values;
+
+  public:
+    void add(double v) { _values.push_back(v); }
+    size_t samples() const { return _values.size(); }
+    double mean() const;
+    // half width of the interval, 95% by default
+    double half_width(double z = 1.96) const;
+};
+
+// ratio of two totals summed over the samples, like misses per access,
+// with the interval of the ratio estimator: samples with more accesses
+// weigh more than in the mean of the per-sample ratios
+class ratio_estimator {
+  private:
+    std::vector<std::pair<double, double>> _values; // numerator, denominator
+
+  public:
+    void add(double num, double den) { _values.emplace_back(num, den); }
+    size_t samples() const { return _values.size(); }
+    double ratio() const;
+    // half width of the interval, 95% by default
+    double half_width(double z = 1.96) const;
+};
+
+class simulation {
+  private:
+    params _params;
+    timing::pipeline _pipeline;
+    cache::hierarchy* _caches;
+    engine::block_engine _fast;
+    estimator _cpi;
+    std::map<std::string, ratio_estimator> _miss_rates;
+    uint64_t _detailed;
+
+  public:
+    // caches may be null, they are attached to the memory only while detailed
+    simulation(const params& p, const timing::config& cfg, cache::hierarchy* caches);
+
+    // run until the guest halts, retired is the running count
+    void run(mem::memory& mem, processor& proc, uint64_t& retired);
+
+    void report(std::ostream& os, uint64_t retired) const;
+};
+
+} // namespace sampling
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <memory.hh>
+
+// Single-pass miss-ratio curves. For every power-of-two number of sets the
+// address stream is split per set and the LRU stack distance of each access
+// is computed as the number of distinct lines touched in the set since the
+// previous access to the same line (Bennett-Kruskal): a Fenwick tree over
+// access times marks the times that are still the last use of some line.
+// An access with distance d hits in every LRU cache of that set count with
+// more than d ways, so one run yields all sizes and associativities.
+namespace cache {
+
+// reuse distances, exact below 64 and in power-of-two buckets above, which
+// is exact again for the power-of-two capacities that are reported
+class reuse_histogram {
+  private:
+    constexpr static size_t exact = 64;
+
+    std::array<uint64_t, exact> _exact;
+    std::array<uint64_t, 33> _log;
+    uint64_t _cold;
+    uint64_t _total;
+
+  public:
+    reuse_histogram() : _exact(), _log(), _cold(0), _total(0) {}
+
+    void add(uint32_t distance);
+    void add_cold() { _cold++; _total++; }
+
+    uint64_t total() const { return _total; }
+
+    // misses of an LRU set with the given ways, a power of two above 64
+    uint64_t misses(uint64_t ways) const;
+};
+
+class stack_distance {
+  private:
+    constexpr static uint32_t none = ~static_cast<uint32_t>(0);
+
+    // timeline of one set
+    struct set_stack {
+        std::vector<uint32_t> _fenwick;
+        std::vector<uint32_t> _owner; // line whose last access happened at a time
+        uint32_t _now;
+        uint32_t _live;
+
+        set_stack() : _fenwick(1), _owner(1, none), _now(0), _live(0) {}
+        void mark(uint32_t t, int32_t delta);
+        uint32_t prefix(uint32_t t) const;
+    };
+
+    unsigned _line_bits;
+    unsigned _configs;                    // set counts 1, 2, 4, ... 2^(configs-1)
+    std::vector<std::vector<set_stack>> _stacks;
+    std::vector<reuse_histogram> _hist;
+    std::unordered_map<uint32_t, uint32_t> _lines; // line -> row of _times
+    std::vector<uint32_t> _times;         // last access time of a line per config, 0 never
+
+    uint32_t push(unsigned config, set_stack& s, uint32_t line);
+    void compact(unsigned config, set_stack& s);
+
+  public:
+    stack_distance(size_t line, unsigned max_set_bits);
+
+    void access(mem::address_t addr);
+
+    size_t line() const { return static_cast<size_t>(1) << _line_bits; }
+    unsigned configs() const { return _configs; }
+    const reuse_histogram& histogram(unsigned set_bits) const { return _hist[set_bits]; }
+};
+
+// instruction and data streams observed from the memory
+class miss_ratio_curves : public mem::observer {
+  private:
+    stack_distance _instr;
+    stack_distance _data;
+
+    static void report(std::ostream& os, const char* name, const stack_distance& sd);
+
+  public:
+    explicit miss_ratio_curves(size_t line, unsigned max_set_bits = 12) :
+        _instr(line, max_set_bits), _data(line, max_set_bits) {}
+
+    void on_access(mem::address_t addr, size_t, mem::access kind) override
+    {
+        (kind == mem::access::fetch ? _instr : _data).access(addr);
+    }
+
+    void report(std::ostream& os) const;
+};
+
+} // namespace cache
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <memory.hh>
+#include <processor.hh>
+#include <replay.hh>
+
+// Syscalls of the RISC-V Linux ABI, as issued by newlib: number in a7,
+// arguments in a0-a5 and the result, or -errno, in a0. Buffers are used
+// in place through host pointers into guest memory, and mmap maps host
+// files straight into the guest address space. Every result and
+// every byte read from the host goes through the replay environment, so a
+// replay never touches the host.
+namespace sys {
+
+enum number : uint32_t {
+    openat = 56,
+    close = 57,
+    lseek = 62,
+    read = 63,
+    write = 64,
+    fstat = 80,
+    exit = 93,
+    exit_group = 94,
+    clock_gettime = 113,
+    brk = 214,
+    munmap = 215,
+    mmap = 222, // mmap2 on rv32, the offset is in pages
+    clock_gettime64 = 403,
+};
+
+class emulator {
+  private:
+    static thread_local emulator* _current;
+
+    replay::environment& _env;
+    std::vector<int> _fds; // host descriptor per guest descriptor, -1 if closed
+    bool _echo; // replays copy the guest stdout and stderr to the host ones
+    bool _exited;
+    int32_t _status;
+
+    // result of a host operation, logged or replayed
+    template<typename F>
+    int32_t result(F host)
+    {
+        return static_cast<int32_t>(_env.value(replay::input::syscall,
+                    [&host] { return static_cast<uint64_t>(static_cast<uint32_t>(host())); }));
+    }
+
+    // len bytes the host left at dst, logged or replayed
+    void input(mem::memory& mem, mem::address_t addr, uint8_t* dst, size_t len);
+
+    int host_fd(uint32_t fd) const;
+
+    int32_t do_openat(mem::memory& mem, uint32_t dirfd, mem::address_t path, uint32_t flags,
+            uint32_t mode);
+    int32_t do_close(uint32_t fd);
+    int32_t do_lseek(uint32_t fd, int32_t offset, uint32_t whence);
+    int32_t do_read(mem::memory& mem, uint32_t fd, mem::address_t buf, uint32_t count);
+    int32_t do_write(mem::memory& mem, uint32_t fd, mem::address_t buf, uint32_t count);
+    int32_t do_fstat(mem::memory& mem, uint32_t fd, mem::address_t buf);
+    int32_t do_clock_gettime(mem::memory& mem, uint32_t clock, mem::address_t buf);
+    int32_t do_brk(mem::memory& mem, mem::address_t addr);
+    int32_t do_mmap(mem::memory& mem, mem::address_t addr, uint32_t length, uint32_t flags,
+            uint32_t fd, uint32_t pgoffset);
+    int32_t do_munmap(mem::memory& mem, mem::address_t addr, uint32_t length);
+
+  public:
+    constexpr static size_t heap_limit = 64 * 1024 * 1024;
+
+    explicit emulator(replay::environment& env);
+    ~emulator();
+
+    emulator(const emulator&) = delete;
+    emulator& operator=(const emulator&) = delete;
+
+    // emulator of the ecalls executed by this thread
+    static emulator& current();
+    void make_current() { _current = this; }
+
+    void set_echo(bool echo) { _echo = echo; }
+
+    // run the syscall of proc, returns the next pc, which is the pc of the
+    // ecall itself once the guest exited so the engines halt
+    mem::address_t ecall(mem::memory& mem, processor& proc);
+
+    bool exited() const { return _exited; }
+    int32_t status() const { return _status; }
+};
+
+} // namespace sys
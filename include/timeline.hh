@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <checkpoint.hh>
+#include <memory.hh>
+#include <processor.hh>
+#include <replay.hh>
+
+// Checkpoints of a recorded or replayed run, every interval instructions,
+// each with the position of the replay log at that point. Any instruction
+// count can then be reached again by restoring the checkpoint before it
+// and replaying at most one interval.
+namespace replay {
+
+class timeline {
+  private:
+    struct point {
+        ckpt::checkpoint _state;
+        environment::cursor _cursor;
+    };
+
+    uint64_t _interval;
+    std::vector<point> _points;
+
+  public:
+    explicit timeline(uint64_t interval = 1 << 20) : _interval(interval), _points() {}
+
+    // run to the halt with the block engine, env must be recording or
+    // replaying and its count must be retired
+    void run(mem::memory& mem, processor& proc, environment& env, uint64_t& retired);
+
+    // state after target instructions, target must not exceed the run
+    void seek(uint64_t target, mem::memory& mem, processor& proc, environment& env,
+            uint64_t& retired) const;
+
+    size_t size() const { return _points.size(); }
+};
+
+} // namespace replay
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include <memory.hh>
+
+// Cycle-approximate model of a classic 5-stage in-order pipeline (IF, ID,
+// EX, MEM, WB) with full forwarding. There is no per-cycle loop: each
+// retired instruction adds one cycle plus the stalls it causes, computed
+// from the register indices of the previous instructions.
+//
+//  - load-use: an instruction needing in EX the result of the load right
+//    before it waits one cycle (store data is forwarded to MEM instead)
+//  - taken branches are resolved in EX, jal in ID and jalr in EX, the
+//    wrong-path instructions behind them are flushed
+//  - multiplies block EX for their whole latency
+namespace timing {
+
+struct config {
+    unsigned _mul_latency = 3;
+    unsigned _branch_penalty = 2;
+    unsigned _jal_penalty = 1;
+    unsigned _jalr_penalty = 2;
+};
+
+// "mul=3,branch=2,jal=1,jalr=2", exits on malformed specs
+config parse(const std::string& spec);
+
+struct stats {
+    uint64_t _instrs;
+    uint64_t _cycles;
+    uint64_t _load_use;
+    uint64_t _branch;
+    uint64_t _jump;
+    uint64_t _mul;
+
+    stats& operator+=(const stats& o);
+};
+
+class pipeline {
+  private:
+    constexpr static unsigned depth = 5;
+
+    config _cfg;
+    stats _stats;
+    uint8_t _load_rd; // destination of the previous instruction if it was a load
+
+  public:
+    explicit pipeline(const config& cfg) : _cfg(cfg), _stats(), _load_rd(0) {}
+
+    void retire(uint32_t bitstream, mem::address_t pc, mem::address_t next_pc);
+
+    // cycles including the pipeline fill
+    uint64_t cycles() const { return _stats._cycles + (_stats._instrs ? depth - 1 : 0); }
+
+    const stats& get_stats() const { return _stats; }
+    void reset_stats() { _stats = stats(); }
+
+    static void report(std::ostream& os, const stats& st);
+    void report(std::ostream& os) const { report(os, _stats); }
+};
+
+} // namespace timing
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <instructions.hh>
+#include <memory.hh>
+#include <processor.hh>
+
+// Compact binary execution traces.
+//
+// A trace is a sequence of blocks, each starting with a snapshot of the
+// register file, followed by an index of the blocks for seeking. Inside a
+// block every retired instruction is one header byte plus optional fields:
+//
+//   bit 0     the pc is not the predicted one, a zigzag varint delta follows
+//   bit 1     the raw instruction follows (first time the pc is seen)
+//   bits 2-7  zigzag delta of the written value against the old rd value,
+//             plus one, or 0 when a varint with the delta follows
+//
+// Memory addresses and store values are not stored: the reader keeps a
+// shadow register file and recomputes them from rs1 + imm and rs2.
+namespace trace {
+
+using regs_t = std::array<uint32_t, 32>;
+
+struct record {
+    mem::address_t pc;
+    uint32_t instr;
+    uint8_t rd;         // 0 when the instruction has no writeback
+    uint32_t rd_value;
+    uint8_t mem_size;   // 0 when the instruction does not access memory
+    bool mem_write;
+    mem::address_t mem_addr;
+    uint32_t mem_value;
+};
+
+// layout of the file
+struct file_header {
+    char _magic[8];     // "RVTRACE"
+    uint32_t _version;
+    uint32_t _block_bytes;
+};
+
+struct block_header {
+    uint32_t _payload;  // bytes of encoded records
+    uint32_t _count;    // records in the block
+    uint64_t _first;    // index of the first record in the trace
+    mem::address_t _pc; // predicted pc of the first record
+    regs_t _regs;
+    uint32_t _reserved; // explicit padding, so files are reproducible
+};
+
+struct index_entry {
+    uint64_t _offset;
+    uint64_t _first;
+    uint32_t _count;
+    uint32_t _reserved;
+};
+
+struct footer {
+    uint64_t _index_offset;
+    uint64_t _blocks;
+    uint64_t _records;
+    char _magic[8];     // "RVTIDX"
+};
+
+// 2: ecall records the value of a0
+constexpr uint32_t version = 2;
+
+constexpr uint32_t ecall = 0x00000073;
+
+// instruction properties both sides of the format agree on
+
+// register written by instr, 0 for none
+inline uint8_t dest_reg(uint32_t instr)
+{
+    uint8_t opcode = instr & 0x7F;
+    if (instr == ecall) {
+        return 10; // syscall result in a0
+    }
+    return opcode != 0b0100011 && opcode != 0b1100011 ? (instr >> 7) & 0x1F : 0;
+}
+
+inline bool is_load(uint32_t instr) { return (instr & 0x7F) == 0b0000011; }
+inline bool is_store(uint32_t instr) { return (instr & 0x7F) == 0b0100011; }
+inline uint8_t access_size(uint32_t instr) { return 1 << ((instr >> 12) & 0b11); }
+
+inline mem::address_t access_address(uint32_t instr, const regs_t& regs)
+{
+    if (is_store(instr)) {
+        instrs::s_instruction si{instr};
+        return regs[si.rs1()] + si.imm();
+    }
+    instrs::i_instruction ii{instr};
+    return regs[ii.rs1()] + ii.imm();
+}
+
+// pc expected after instr, computed with the registers before its writeback
+mem::address_t predict_next(uint32_t instr, mem::address_t pc, const regs_t& regs);
+
+// fill the fields of rec known before executing instr
+inline void capture(const processor& proc, mem::address_t pc, uint32_t instr, record& rec)
+{
+    rec.pc = pc;
+    rec.instr = instr;
+    rec.rd = dest_reg(instr);
+    rec.mem_size = 0;
+    rec.mem_write = false;
+    if (is_load(instr) || is_store(instr)) {
+        regs_t regs;
+        uint8_t rs1 = (instr >> 15) & 0x1F;
+        regs[rs1] = proc.read_reg(rs1);
+        rec.mem_size = access_size(instr);
+        rec.mem_write = is_store(instr);
+        rec.mem_addr = access_address(instr, regs);
+        uint32_t mask = rec.mem_size == 4 ? ~0u : (1u << (8 * rec.mem_size)) - 1;
+        rec.mem_value = rec.mem_write ? proc.read_reg((instr >> 20) & 0x1F) & mask : 0;
+    }
+}
+
+// fill the fields of rec known after executing it
+inline void complete(const processor& proc, const mem::memory& mem, record& rec)
+{
+    rec.rd_value = proc.read_reg(rec.rd);
+    if (rec.mem_size != 0 && !rec.mem_write) {
+        switch (rec.mem_size) {
+            case 1: rec.mem_value = mem.peek<uint8_t>(rec.mem_addr); break;
+            case 2: rec.mem_value = mem.peek<uint16_t>(rec.mem_addr); break;
+            default: rec.mem_value = mem.peek<uint32_t>(rec.mem_addr); break;
+        }
+    }
+}
+
+inline regs_t snapshot(const processor& proc)
+{
+    regs_t regs;
+    for (size_t i = 0; i < regs.size(); ++i) {
+        regs[i] = proc.read_reg(i);
+    }
+    return regs;
+}
+
+// Streams records to a file in blocks of about block_bytes.
+class writer {
+  private:
+    constexpr static size_t dict_size = 4096;
+
+    std::FILE* _file;
+    uint32_t _block_bytes;
+    std::vector<uint8_t> _payload;
+    std::vector<index_entry> _index;
+    block_header _block;
+    regs_t _regs;
+    mem::address_t _next_pc;
+    uint64_t _records;
+    std::array<std::pair<mem::address_t, uint32_t>, dict_size> _dict;
+
+    void flush();
+
+  public:
+    writer(const std::string& path, uint32_t block_bytes = 64 * 1024);
+    ~writer();
+
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    // start a new block from a known register file and pc, needed whenever
+    // the registers change without a record or records are skipped
+    void sync(const regs_t& regs, mem::address_t pc);
+
+    void append(const record& rec);
+
+    // write the last block and the index
+    void close();
+
+    uint64_t records() const { return _records; }
+};
+
+// Streams records back, seeking through the block index.
+class reader {
+  private:
+    constexpr static size_t dict_size = 4096;
+
+    std::FILE* _file;
+    std::vector<index_entry> _index;
+    uint64_t _records;
+    size_t _next_block;
+    std::vector<uint8_t> _payload;
+    size_t _pos;
+    uint32_t _left;
+    uint64_t _current;
+    regs_t _regs;
+    mem::address_t _next_pc;
+    std::array<std::pair<mem::address_t, uint32_t>, dict_size> _dict;
+
+    void scan_blocks();
+    bool load_block(size_t i);
+
+  public:
+    explicit reader(const std::string& path);
+    ~reader();
+
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    uint64_t records() const { return _records; }
+    const std::vector<index_entry>& blocks() const { return _index; }
+
+    // index of the record returned by the next call to next
+    uint64_t position() const { return _current; }
+
+    // registers before the record returned by the next call to next
+    const regs_t& regs() const { return _regs; }
+
+    void seek(uint64_t record_index);
+    bool next(record& rec);
+};
+
+} // namespace trace
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <iomanip>
+
+#include <analysis.hh>
+
+using namespace analysis;
+
+dispatcher::dispatcher(size_t ring_batches) :
+    _ring(ring_batches), _head(0), _consumers(), _current(&_ring[0])
+{
+    _current->_count = 0;
+}
+
+dispatcher::~dispatcher()
+{
+    // stop the consumers if finish was never called
+    _head.fetch_or(done_bit, std::memory_order_release);
+    _head.notify_all();
+    for (auto& c : _consumers) {
+        if (c->_thread.joinable()) {
+            c->_thread.join();
+        }
+    }
+}
+
+void dispatcher::add_consumer(std::vector<std::unique_ptr<plugin>> plugins)
+{
+    auto c = std::make_unique<consumer>();
+    c->_tail.store(0);
+    c->_plugins = std::move(plugins);
+    _consumers.push_back(std::move(c));
+}
+
+void dispatcher::add_consumer(std::unique_ptr<plugin> p)
+{
+    std::vector<std::unique_ptr<plugin>> plugins;
+    plugins.push_back(std::move(p));
+    add_consumer(std::move(plugins));
+}
+
+void dispatcher::start()
+{
+    for (auto& c : _consumers) {
+        c->_thread = std::thread(&dispatcher::run, this, std::ref(*c));
+    }
+}
+
+uint64_t dispatcher::slowest() const
+{
+    uint64_t tail = ~static_cast<uint64_t>(0);
+    for (const auto& c : _consumers) {
+        tail = std::min(tail, c->_tail.load(std::memory_order_acquire));
+    }
+    return tail;
+}
+
+void dispatcher::publish()
+{
+    uint64_t head = _head.load(std::memory_order_relaxed) + 1;
+    _head.store(head, std::memory_order_release);
+    _head.notify_all();
+
+    // backpressure: the next slot must have been consumed by everybody
+    while (head - slowest() >= _ring.size()) {
+        for (const auto& c : _consumers) {
+            uint64_t tail = c->_tail.load(std::memory_order_acquire);
+            if (head - tail >= _ring.size()) {
+                c->_tail.wait(tail, std::memory_order_acquire);
+            }
+        }
+    }
+
+    _current = &_ring[head % _ring.size()];
+    _current->_count = 0;
+}
+
+void dispatcher::run(consumer& c)
+{
+    uint64_t tail = 0;
+    for (;;) {
+        uint64_t state = _head.load(std::memory_order_acquire);
+        uint64_t head = state & ~done_bit;
+        if (head == tail) {
+            if (state & done_bit) {
+                return;
+            }
+            _head.wait(state, std::memory_order_acquire);
+            continue;
+        }
+
+        for (; tail != head; ++tail) {
+            const batch& b = _ring[tail % _ring.size()];
+            for (auto& p : c._plugins) {
+                p->on_batch(b._events.data(), b._count);
+            }
+            c._tail.store(tail + 1, std::memory_order_release);
+            c._tail.notify_one();
+        }
+    }
+}
+
+void dispatcher::finish(std::ostream& os)
+{
+    if (_current->_count != 0) {
+        publish();
+    }
+    _head.fetch_or(done_bit, std::memory_order_release);
+    _head.notify_all();
+
+    for (auto& c : _consumers) {
+        if (c->_thread.joinable()) {
+            c->_thread.join();
+        }
+    }
+    for (auto& c : _consumers) {
+        for (auto& p : c->_plugins) {
+            p->report(os);
+        }
+    }
+}
+
+// trace_plugin
+
+trace_plugin::trace_plugin(const std::string& path, const trace::regs_t& regs, mem::address_t pc) :
+    _writer(path)
+{
+    _writer.sync(regs, pc);
+}
+
+void trace_plugin::on_batch(const event* events, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        _writer.append(events[i]);
+    }
+}
+
+void trace_plugin::report(std::ostream& os)
+{
+    _writer.close();
+    os << "Traced instructions: " << std::dec << _writer.records() << std::endl;
+}
+
+// mix_plugin
+
+void mix_plugin::on_batch(const event* events, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const event& e = events[i];
+        _opcodes[e.instr & 0x7F]++;
+        (e.mem_write ? _stored : _loaded) += e.mem_size;
+    }
+}
+
+void mix_plugin::report(std::ostream& os)
+{
+    uint64_t total = 0;
+    for (uint64_t n : _opcodes) {
+        total += n;
+    }
+
+    os << std::dec << "Instruction mix:" << std::endl;
+    for (size_t op = 0; op < _opcodes.size(); ++op) {
+        if (_opcodes[op] != 0) {
+            os << "  " << std::left << std::setw(8) << instrs::opcode_name(op) << std::right
+               << std::setw(14) << _opcodes[op] << std::fixed << std::setprecision(1)
+               << std::setw(7) << 100.0 * static_cast<double>(_opcodes[op]) / static_cast<double>(total)
+               << '%' << std::endl;
+        }
+    }
+    os.unsetf(std::ios::floatfield);
+    os << "  bytes loaded " << _loaded << ", stored " << _stored << std::endl;
+}
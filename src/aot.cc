@@ -0,0 +1,339 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <aot.hh>
+#include <instructions.hh>
+#include <ir.hh>
+
+#include <dlfcn.h>
+
+using namespace aot;
+using namespace mem;
+
+namespace {
+
+constexpr size_t max_block = 64;
+
+struct range {
+    address_t _begin;
+    address_t _end;
+};
+
+// bytes of the executable segments read from the file
+std::vector<range> text(const memory& mem)
+{
+    std::vector<range> ranges;
+    for (const Elf32_Phdr& phdr : mem.program_headers()) {
+        if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X)) {
+            ranges.push_back(range{phdr.p_vaddr, phdr.p_vaddr + phdr.p_filesz});
+        }
+    }
+    return ranges;
+}
+
+bool inside(const std::vector<range>& ranges, address_t addr)
+{
+    for (const range& r : ranges) {
+        if (addr >= r._begin && addr + 4 <= r._end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// opcodes the translation knows, the rest is left to the interpreter
+bool supported(uint32_t bitstream)
+{
+    switch (bitstream & 0x7F) {
+        case 0b0000011: case 0b0100011: case 0b0010011: case 0b0110011:
+        case 0b0110111: case 0b1101111: case 0b1100111: case 0b1100011:
+        case 0b1110011:
+            return true;
+    }
+    return false;
+}
+
+// jal, jalr and branches end the block
+bool transfer(uint32_t bitstream)
+{
+    return (bitstream & 0x73) == 0b1100011;
+}
+
+std::string hex(uint32_t val)
+{
+    std::ostringstream os;
+    os << "0x" << std::hex << val << "u";
+    return os.str();
+}
+
+std::string value(uint32_t v)
+{
+    std::string s = "v";
+    s += std::to_string(v);
+    return s;
+}
+
+// low size bytes of expr, extended like ir::op::extend
+std::string extended(const std::string& expr, uint8_t size, bool is_signed)
+{
+    switch (size) {
+        case 1: return is_signed ? "uint32_t(int32_t(int8_t(" + expr + ")))" : "uint32_t(uint8_t(" + expr + "))";
+        case 2: return is_signed ? "uint32_t(int32_t(int16_t(" + expr + ")))" : "uint32_t(uint16_t(" + expr + "))";
+    }
+    return expr;
+}
+
+const char* type(uint8_t size)
+{
+    return size == 1 ? "uint8_t" : size == 2 ? "uint16_t" : "uint32_t";
+}
+
+// branch condition funct3 on x and y
+std::string condition(uint8_t cond, const std::string& x, const std::string& y)
+{
+    switch (cond) {
+        case 0b000: return x + " == " + y;
+        case 0b001: return x + " != " + y;
+        case 0b100: return "int32_t(" + x + ") < int32_t(" + y + ")";
+        case 0b101: return "int32_t(" + x + ") >= int32_t(" + y + ")";
+        case 0b110: return x + " < " + y;
+        case 0b111: return x + " >= " + y;
+    }
+    return "false";
+}
+
+// leave before a misaligned load or store, the handlers run it
+void emit_misaligned(std::ostream& os, const ir::node& n)
+{
+    if (n._size > 1) {
+        os << "    if ((" << value(n._a) << " & " << n._size - 1 << ") != 0) {\n"
+           << "        retired = start + " << n._index << ";\n"
+           << "        return aot::outcome{" << hex(n._pc) << ", false, true};\n"
+           << "    }\n";
+    }
+}
+
+// leave after a store or a system node that wrote decoded code
+void emit_rewritten(std::ostream& os, const ir::node& n)
+{
+    os << "    if (mem.code_written()) {\n"
+       << "        retired = start + " << n._index + 1 << ";\n"
+       << "        return aot::outcome{" << hex(n._pc + 4) << ", false, false};\n"
+       << "    }\n";
+}
+
+// Body of one block, a statement per node of its optimised IR, as ir::run
+// would run them.
+void emit_block(std::ostream& os, const ir::block& b)
+{
+    for (uint32_t i = 0; i < b._nodes.size(); ++i) {
+        const ir::node& n = b._nodes[i];
+        std::string def = "    const uint32_t " + value(i) + " = ";
+        switch (n._op) {
+        case ir::op::constant: os << def << hex(n._imm) << ";\n"; break;
+        case ir::op::get: os << def << "proc.read_reg(" << unsigned(n._reg) << ");\n"; break;
+        case ir::op::addi: os << def << value(n._a) << " + " << hex(n._imm) << ";\n"; break;
+        case ir::op::shli: os << def << value(n._a) << " << " << n._imm << ";\n"; break;
+        case ir::op::add: os << def << value(n._a) << " + " << value(n._b) << ";\n"; break;
+        case ir::op::sub: os << def << value(n._a) << " - " << value(n._b) << ";\n"; break;
+        case ir::op::mul: os << def << value(n._a) << " * " << value(n._b) << ";\n"; break;
+        case ir::op::extend: os << def << extended(value(n._a), n._size, n._signed) << ";\n"; break;
+        case ir::op::load:
+            emit_misaligned(os, n);
+            os << def << extended("mem.read<" + std::string(type(n._size)) + ">(" + value(n._a) + ")",
+                    n._size, n._signed) << ";\n";
+            break;
+        case ir::op::store:
+            emit_misaligned(os, n);
+            os << "    mem.write<" << type(n._size) << ">(" << value(n._a) << ", "
+               << type(n._size) << "(" << value(n._b) << "));\n";
+            emit_rewritten(os, n);
+            break;
+        case ir::op::set: os << "    proc.write_reg(" << unsigned(n._reg) << ", " << value(n._a) << ");\n"; break;
+        case ir::op::system:
+            // the counters see the instructions retired before this one
+            os << "    retired = start + " << n._index << ";\n"
+               << "    proc.write_pc(" << hex(n._pc) << ");\n"
+               << "    if (instrs::system(mem, proc, " << hex(n._imm) << ") == " << hex(n._pc) << ") {\n"
+               << "        retired += 1;\n"
+               << "        return aot::outcome{" << hex(n._pc) << ", true, false};\n"
+               << "    }\n";
+            emit_rewritten(os, n);
+            break;
+        case ir::op::guard:
+            os << "    if (" << condition(n._cond, value(n._a), value(n._b)) << ") {\n"
+               << "        retired = start + " << n._index + 1 << ";\n"
+               << "        return aot::outcome{" << hex(n._imm) << ", " << (n._imm == n._pc ? "true" : "false") << ", false};\n"
+               << "    }\n";
+            break;
+        case ir::op::nop:
+            break;
+        }
+    }
+
+    os << "    retired = start + " << b._length << ";\n";
+    switch (b._ending) {
+    case ir::ending::next:
+        os << "    return aot::outcome{" << hex(b._next) << ", false, false};\n";
+        break;
+    case ir::ending::jump:
+        os << "    return aot::outcome{" << hex(b._target) << ", " << (b._target == b._last ? "true" : "false") << ", false};\n";
+        break;
+    case ir::ending::indirect:
+        os << "    const uint32_t next = " << value(b._a) << " & ~1u;\n"
+           << "    return aot::outcome{next, next == " << hex(b._last) << ", false};\n";
+        break;
+    case ir::ending::branch: {
+        os << "    const bool taken = " << condition(b._cond, value(b._a), value(b._b)) << ";\n"
+           << "    return aot::outcome{taken ? " << hex(b._target) << " : " << hex(b._next) << ", "
+           << (b._target == b._last ? "taken" : "false") << ", false};\n";
+        break;
+    }
+    }
+}
+
+} // namespace
+
+uint64_t aot::text_hash(const memory& mem)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&hash](uint8_t byte) {
+        hash = (hash ^ byte) * 0x100000001b3;
+    };
+    for (const range& r : text(mem)) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            mix(static_cast<uint8_t>(r._begin >> shift));
+            mix(static_cast<uint8_t>(r._end >> shift));
+        }
+        for (address_t addr = r._begin; addr < r._end; ++addr) {
+            mix(mem.peek<uint8_t>(addr));
+        }
+    }
+    return hash;
+}
+
+void aot::translate(const memory& mem, std::ostream& os)
+{
+    std::vector<range> ranges = text(mem);
+
+    // blocks start at the entry point, the jump and branch targets and
+    // after every control transfer, so that returns land on a block
+    std::set<address_t> leaders;
+    leaders.insert(mem.entry_point());
+    for (const range& r : ranges) {
+        leaders.insert(r._begin);
+        for (address_t pc = r._begin; pc + 4 <= r._end; pc += 4) {
+            uint32_t bitstream = mem.peek<uint32_t>(pc);
+            address_t target = pc;
+            if ((bitstream & 0x7F) == 0b1101111) {
+                target += instrs::j_instruction{bitstream}.imm();
+            } else if ((bitstream & 0x7F) == 0b1100011) {
+                target += instrs::b_instruction{bitstream}.imm();
+            }
+            if (target != pc && inside(ranges, target)) {
+                leaders.insert(target);
+            }
+            if (transfer(bitstream)) {
+                leaders.insert(pc + 4);
+            }
+        }
+    }
+
+    // linear sweep, words that do not decode are data or unknown code
+    std::vector<std::pair<address_t, size_t>> blocks;
+    for (const range& r : ranges) {
+        address_t pc = r._begin;
+        while (pc + 4 <= r._end) {
+            if (!supported(mem.peek<uint32_t>(pc))) {
+                pc += 4;
+                continue;
+            }
+            address_t start = pc;
+            size_t length = 0;
+            while (pc + 4 <= r._end && length < max_block
+                    && (length == 0 || !leaders.contains(pc))) {
+                uint32_t bitstream = mem.peek<uint32_t>(pc);
+                if (!supported(bitstream)) {
+                    break;
+                }
+                pc += 4;
+                ++length;
+                if (transfer(bitstream)) {
+                    break;
+                }
+            }
+            blocks.emplace_back(start, length);
+        }
+    }
+
+    os << "// Generated by periscvcope-aot, do not edit\n\n"
+       << "#include <aot.hh>\n"
+       << "#include <instructions.hh>\n\n"
+       << "namespace {\n\n";
+    for (const auto& [start, length] : blocks) {
+        os << "aot::outcome block_" << std::hex << std::setfill('0') << std::setw(8) << start
+           << std::dec << std::setfill(' ')
+           << "([[maybe_unused]] mem::memory& mem, [[maybe_unused]] processor& proc, uint64_t& retired)\n{\n";
+        std::vector<uint32_t> bitstreams;
+        for (size_t i = 0; i < length; ++i) {
+            bitstreams.push_back(mem.peek<uint32_t>(start + 4 * static_cast<address_t>(i)));
+        }
+        std::unique_ptr<ir::block> b = ir::lower(bitstreams, start);
+        assert(b); // only supported opcodes and a transfer at the end
+        ir::optimise(*b);
+        os << "    const uint64_t start = retired;\n";
+        emit_block(os, *b);
+        os << "}\n\n";
+    }
+
+    if (!blocks.empty()) {
+        os << "const aot::entry entries[] = {\n";
+        for (const auto& [start, length] : blocks) {
+            os << "    {" << hex(start) << ", " << length << ", block_" << std::hex << std::setfill('0')
+               << std::setw(8) << start << std::dec << std::setfill(' ') << "},\n";
+        }
+        os << "};\n\n";
+    }
+    os << "} // namespace\n\n"
+       << "extern \"C\" const aot::image " << image_symbol << " = {\n"
+       << "    " << version << ", 0x" << std::hex << text_hash(mem) << std::dec << "ull, "
+       << blocks.size() << ", " << (blocks.empty() ? "nullptr" : "entries") << "\n};\n";
+}
+
+module::module(const std::string& file, const memory& mem) : _handle(nullptr), _entries()
+{
+    // a bare name would be looked up in the library path
+    std::string path = file.find('/') == std::string::npos ? "./" + file : file;
+    _handle = ::dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (_handle == nullptr) {
+        std::cerr << "Unable to load " << file << ": " << ::dlerror() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    auto img = static_cast<const image*>(::dlsym(_handle, image_symbol));
+    if (img == nullptr) {
+        std::cerr << file << " is not a translated program" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (img->_version != version) {
+        std::cerr << file << " was translated by another version, translate it again" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (img->_hash != text_hash(mem)) {
+        std::cerr << file << " was translated from another program" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    for (uint64_t i = 0; i < img->_count; ++i) {
+        _entries[img->_entries[i]._pc] = &img->_entries[i];
+    }
+}
+
+module::~module()
+{
+    ::dlclose(_handle);
+}
@@ -0,0 +1,62 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <aot.hh>
+#include <memory.hh>
+
+// Ahead-of-time translator: writes the C++ translation of a program and
+// builds it into a shared object for periscvcope --fast --aot=<object>.
+// The compiler and headers are the ones the simulator was built with.
+
+static void usage()
+{
+    std::cerr << "Invalid Syntax: periscvcope-aot <program> <output>" << std::endl
+              << "  <output>.so            translate and build the shared object" << std::endl
+              << "  <output>.cc            only write the translation unit" << std::endl;
+    exit(1);
+}
+
+static bool ends_with(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        usage();
+    }
+
+    std::string program = argv[1];
+    std::string output = argv[2];
+    bool build = ends_with(output, ".so");
+    if (!build && !ends_with(output, ".cc")) {
+        usage();
+    }
+    std::string source = build ? output.substr(0, output.size() - 3) + ".cc" : output;
+
+    mem::memory mem;
+    mem.load_binary(program);
+
+    std::ofstream ofile(source);
+    if (!ofile) {
+        std::cerr << "Unable to open " << source << std::endl;
+        return EXIT_FAILURE;
+    }
+    aot::translate(mem, ofile);
+    ofile.close();
+
+    if (!build) {
+        return 0;
+    }
+
+    std::string command = std::string(PERISCVCOPE_CXX) + " -std=c++20 -O2 -fPIC -shared -I"
+        + PERISCVCOPE_INCLUDE + " -o '" + output + "' '" + source + "'";
+    if (std::system(command.c_str()) != 0) {
+        std::cerr << "Unable to build " << output << " with: " << command << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
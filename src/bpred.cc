@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <bpred.hh>
+#include <instructions.hh>
+
+using namespace bpred;
+using namespace mem;
+
+// bimodal
+
+std::string bimodal::name() const
+{
+    return "bimodal-" + std::to_string(1 << _bits);
+}
+
+bool bimodal::predict(address_t pc, address_t)
+{
+    return _counters.get((pc >> 2) & ((1u << _bits) - 1)) >= 2;
+}
+
+void bimodal::update(address_t pc, bool taken)
+{
+    _counters.train((pc >> 2) & ((1u << _bits) - 1), taken);
+}
+
+// gshare
+
+std::string gshare::name() const
+{
+    return "gshare-" + std::to_string(1 << _bits) + "/" + std::to_string(_history_bits);
+}
+
+size_t gshare::index(address_t pc) const
+{
+    uint64_t history = _history & ((static_cast<uint64_t>(1) << _history_bits) - 1);
+    return ((pc >> 2) ^ history) & ((static_cast<uint64_t>(1) << _bits) - 1);
+}
+
+bool gshare::predict(address_t pc, address_t)
+{
+    return _counters.get(index(pc)) >= 2;
+}
+
+void gshare::update(address_t pc, bool taken)
+{
+    _counters.train(index(pc), taken);
+    _history = (_history << 1) | taken;
+}
+
+// tage_lite
+
+tage_lite::tage_lite() : _base(4096, 1), _tagged(), _history(0), _branches(0),
+    _seed(0x2545F491), _index(), _tag(), _provider(-1), _provider_pred(false), _alt_pred(false)
+{
+    for (unsigned i = 0; i < tables; ++i) {
+        _tagged.emplace_back(1 << table_bits, 0);
+    }
+}
+
+size_t tage_lite::bytes() const
+{
+    size_t n = _base.bytes();
+    for (const auto& t : _tagged) {
+        n += t.bytes();
+    }
+    return n;
+}
+
+uint32_t tage_lite::fold(unsigned length, unsigned bits) const
+{
+    uint64_t h = length >= 64 ? _history : _history & ((static_cast<uint64_t>(1) << length) - 1);
+    uint32_t folded = 0;
+    for (; h != 0; h >>= bits) {
+        folded ^= static_cast<uint32_t>(h & ((1u << bits) - 1));
+    }
+    return folded;
+}
+
+bool tage_lite::predict(address_t pc, address_t)
+{
+    uint32_t p = pc >> 2;
+    _provider = -1;
+    int alt = -1;
+    for (unsigned i = 0; i < tables; ++i) {
+        _index[i] = (p ^ (p >> table_bits) ^ fold(history_lengths[i], table_bits) ^ i)
+            & ((1u << table_bits) - 1);
+        _tag[i] = static_cast<uint16_t>((p ^ fold(history_lengths[i], 11) ^ (fold(history_lengths[i], 10) << 1)) & 0x7FF);
+        // tables start zeroed, tag 0 marks an empty entry
+        if (_tag[i] == 0) {
+            _tag[i] = 1;
+        }
+    }
+    for (int i = tables - 1; i >= 0; --i) {
+        if (entry_bits::tag(static_cast<uint16_t>(_tagged[i].get(_index[i]))) == _tag[i]) {
+            if (_provider < 0) {
+                _provider = i;
+            } else {
+                alt = i;
+                break;
+            }
+        }
+    }
+
+    bool base_pred = _base.get(p & 4095) >= 2;
+    _alt_pred = alt >= 0 ? entry_bits::ctr(static_cast<uint16_t>(_tagged[alt].get(_index[alt]))) >= 4 : base_pred;
+    _provider_pred = _provider >= 0 ? entry_bits::ctr(static_cast<uint16_t>(_tagged[_provider].get(_index[_provider]))) >= 4 : base_pred;
+    return _provider_pred;
+}
+
+void tage_lite::update(address_t pc, bool taken)
+{
+    if (_provider >= 0) {
+        auto& table = _tagged[_provider];
+        uint16_t e = static_cast<uint16_t>(table.get(_index[_provider]));
+        uint16_t ctr = entry_bits::ctr(e);
+        uint16_t useful = entry_bits::useful(e);
+        ctr = taken ? std::min<uint16_t>(ctr + 1, 7) : (ctr > 0 ? ctr - 1 : 0);
+        if (_provider_pred != _alt_pred) {
+            useful = _provider_pred == taken ? std::min<uint16_t>(useful + 1, 3) : (useful > 0 ? useful - 1 : 0);
+        }
+        table.set(_index[_provider], entry_bits::make(ctr, useful, entry_bits::tag(e)));
+    } else {
+        _base.train((pc >> 2) & 4095, taken);
+    }
+
+    // on a misprediction allocate an entry with a longer history
+    if (_provider_pred != taken && _provider < static_cast<int>(tables) - 1) {
+        std::vector<unsigned> free;
+        for (unsigned i = _provider + 1; i < tables; ++i) {
+            if (entry_bits::useful(static_cast<uint16_t>(_tagged[i].get(_index[i]))) == 0) {
+                free.push_back(i);
+            }
+        }
+        if (free.empty()) {
+            for (unsigned i = _provider + 1; i < tables; ++i) {
+                uint16_t e = static_cast<uint16_t>(_tagged[i].get(_index[i]));
+                _tagged[i].set(_index[i], entry_bits::make(entry_bits::ctr(e), entry_bits::useful(e) - 1, entry_bits::tag(e)));
+            }
+        } else {
+            // prefer the shortest history, sometimes the next one
+            _seed ^= _seed << 13;
+            _seed ^= _seed >> 17;
+            _seed ^= _seed << 5;
+            unsigned i = free[(free.size() > 1 && (_seed & 3) == 0) ? 1 : 0];
+            _tagged[i].set(_index[i], entry_bits::make(taken ? 4 : 3, 0, _tag[i]));
+        }
+    }
+
+    // age the useful counters
+    if ((++_branches & ((1 << 18) - 1)) == 0) {
+        for (auto& table : _tagged) {
+            for (size_t i = 0; i < (1u << table_bits); ++i) {
+                uint16_t e = static_cast<uint16_t>(table.get(i));
+                table.set(i, entry_bits::make(entry_bits::ctr(e), entry_bits::useful(e) >> 1, entry_bits::tag(e)));
+            }
+        }
+    }
+
+    _history = (_history << 1) | taken;
+}
+
+// btb
+
+bool btb::hit(address_t pc, address_t target) const
+{
+    uint64_t e = _entries[(pc >> 2) & ((1u << _bits) - 1)];
+    uint64_t tag = pc >> (2 + _bits);
+    return (e >> 63) && ((e >> 32) & 0x7FFFFFFF) == tag && static_cast<address_t>(e) == target;
+}
+
+void btb::update(address_t pc, address_t target)
+{
+    uint64_t tag = pc >> (2 + _bits);
+    _entries[(pc >> 2) & ((1u << _bits) - 1)] = (static_cast<uint64_t>(1) << 63) | (tag << 32) | target;
+}
+
+// simulator
+
+simulator::simulator(const std::string& spec) :
+    _predictors(), _mispredicts(), _branches(), _conditional(0), _taken(0),
+    _btb(9), _transfers(0), _btb_hits(0), _ras(16), _returns(0), _ras_hits(0)
+{
+    std::istringstream names(spec.empty() ? "static,bimodal,gshare,tage" : spec);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        if (name == "static") {
+            _predictors.push_back(std::make_unique<static_btfn>());
+        } else if (name == "bimodal") {
+            _predictors.push_back(std::make_unique<bimodal>(12));
+        } else if (name == "gshare") {
+            _predictors.push_back(std::make_unique<gshare>(14, 12));
+        } else if (name == "tage") {
+            _predictors.push_back(std::make_unique<tage_lite>());
+        } else {
+            std::cerr << "Invalid branch predictor: " << name << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    _mispredicts.resize(_predictors.size(), 0);
+}
+
+void simulator::on_control(uint32_t bitstream, address_t pc, address_t next_pc)
+{
+    bool taken = next_pc != pc + 4;
+    uint8_t opcode = bitstream & 0x7F;
+
+    if (opcode == 0b1100011) {
+        address_t target = pc + instrs::b_instruction{bitstream}.imm();
+        _conditional++;
+        _taken += taken;
+
+        branch_stats& st = _branches[pc];
+        if (st._mispredicts.empty()) {
+            st._mispredicts.resize(_predictors.size(), 0);
+        }
+        st._executed++;
+        st._taken += taken;
+
+        for (size_t i = 0; i < _predictors.size(); ++i) {
+            if (_predictors[i]->predict(pc, target) != taken) {
+                _mispredicts[i]++;
+                st._mispredicts[i]++;
+            }
+            _predictors[i]->update(pc, taken);
+        }
+    } else {
+        // rd and rs1 share the same position in the J and I formats
+        instrs::i_instruction ii{bitstream};
+        auto link = [](uint8_t r) { return r == 1 || r == 5; };
+        if (opcode == 0b1100111 && ii.rd() == 0 && link(ii.rs1())) {
+            _returns++;
+            _ras_hits += _ras.pop() == next_pc;
+            return;
+        }
+        if (link(ii.rd())) {
+            _ras.push(pc + 4);
+        }
+    }
+
+    if (taken) {
+        _transfers++;
+        _btb_hits += _btb.hit(pc, next_pc);
+        _btb.update(pc, next_pc);
+    }
+}
+
+void simulator::report(std::ostream& os, const memory& mem, uint64_t retired) const
+{
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+    };
+
+    os << std::dec << std::fixed << std::setprecision(2)
+       << "Branch prediction: " << _conditional << " conditional branches, "
+       << percent(_taken, _conditional) << "% taken" << std::endl
+       << "  predictor             bytes  mispredicts  accuracy      MPKI" << std::endl;
+    for (size_t i = 0; i < _predictors.size(); ++i) {
+        os << "  " << std::left << std::setw(18) << _predictors[i]->name() << std::right
+           << std::setw(8) << _predictors[i]->bytes() << std::setw(13) << _mispredicts[i]
+           << std::setw(9) << 100.0 - percent(_mispredicts[i], _conditional) << '%'
+           << std::setw(10) << 1000.0 * static_cast<double>(_mispredicts[i]) / static_cast<double>(std::max<uint64_t>(retired, 1))
+           << std::endl;
+    }
+    os << "  btb-" << _btb.entries() << ": " << percent(_btb_hits, _transfers)
+       << "% of " << _transfers << " taken transfers" << std::endl
+       << "  ras-" << _ras.entries() << ": " << percent(_ras_hits, _returns)
+       << "% of " << _returns << " returns" << std::endl;
+
+    std::vector<std::pair<uint64_t, address_t>> worst;
+    for (const auto& [pc, st] : _branches) {
+        uint64_t n = 0;
+        for (uint64_t m : st._mispredicts) {
+            n = std::max(n, m);
+        }
+        worst.emplace_back(n, pc);
+    }
+    std::sort(worst.rbegin(), worst.rend());
+    worst.resize(std::min<size_t>(worst.size(), 10));
+
+    os << "          pc    executed  taken%";
+    for (const auto& p : _predictors) {
+        os << std::setw(16) << p->name();
+    }
+    os << "  function" << std::endl;
+    for (auto [n, pc] : worst) {
+        const branch_stats& st = _branches.at(pc);
+        os << "  0x" << std::hex << std::setw(8) << std::setfill('0') << pc << std::dec
+           << std::setfill(' ') << std::setw(12) << st._executed
+           << std::setw(8) << percent(st._taken, st._executed);
+        for (uint64_t m : st._mispredicts) {
+            os << std::setw(16) << m;
+        }
+        os << "  " << mem.symbol_name(pc) << std::endl;
+    }
+    os.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cache.hh>
+
+using namespace cache;
+using namespace mem;
+
+stats& stats::operator+=(const stats& o)
+{
+    _reads += o._reads;
+    _writes += o._writes;
+    _read_misses += o._read_misses;
+    _write_misses += o._write_misses;
+    _evictions += o._evictions;
+    _writebacks += o._writebacks;
+    return *this;
+}
+
+level::level(const config& cfg, level* next) :
+    _cfg(cfg), _sets(0), _line_bits(0), _next(next), _tags(), _dirty(), _stamps(),
+    _tree(), _clock(0), _seed(0x9E3779B9), _stats(), _pc_misses()
+{
+    bool valid = cfg._line >= 4 && std::has_single_bit(cfg._line)
+        && cfg._assoc > 0 && cfg._size % (cfg._assoc * cfg._line) == 0
+        && std::has_single_bit(cfg._size / (cfg._assoc * cfg._line))
+        && (cfg._policy != policy::plru || (std::has_single_bit(cfg._assoc) && cfg._assoc <= 64));
+    if (!valid) {
+        std::cerr << "Invalid cache geometry for " << cfg._name << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    _sets = cfg._size / (cfg._assoc * cfg._line);
+    _line_bits = std::countr_zero(cfg._line);
+    _tags.assign(_sets * cfg._assoc, invalid);
+    _dirty.assign(_sets * cfg._assoc, 0);
+    _stamps.assign(_sets * cfg._assoc, 0);
+    _tree.assign(_sets, 0);
+}
+
+size_t level::find(size_t set, uint32_t tag) const
+{
+    const uint32_t* row = &_tags[set * _cfg._assoc];
+    size_t way = 0;
+#ifdef __SSE2__
+    const __m128i key = _mm_set1_epi32(static_cast<int>(tag));
+    for (; way + 4 <= _cfg._assoc; way += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + way)), key);
+        unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+        if (mask != 0) {
+            return way + std::countr_zero(mask);
+        }
+    }
+#endif
+    for (; way < _cfg._assoc; ++way) {
+        if (row[way] == tag) {
+            return way;
+        }
+    }
+    return _cfg._assoc;
+}
+
+size_t level::victim(size_t set)
+{
+    size_t way = find(set, invalid);
+    if (way != _cfg._assoc) {
+        return way;
+    }
+
+    switch (_cfg._policy) {
+        case policy::lru: {
+            const uint64_t* stamps = &_stamps[set * _cfg._assoc];
+            return std::min_element(stamps, stamps + _cfg._assoc) - stamps;
+        }
+        case policy::plru: {
+            // follow the tree bits towards the least recently used half
+            size_t node = 1;
+            while (node < _cfg._assoc) {
+                node = 2 * node + ((_tree[set] >> node) & 1);
+            }
+            return node - _cfg._assoc;
+        }
+        case policy::random:
+            _seed ^= _seed << 13;
+            _seed ^= _seed >> 17;
+            _seed ^= _seed << 5;
+            return _seed % _cfg._assoc;
+    }
+    return 0;
+}
+
+void level::touch(size_t set, size_t way)
+{
+    switch (_cfg._policy) {
+        case policy::lru:
+            _stamps[set * _cfg._assoc + way] = ++_clock;
+            break;
+        case policy::plru:
+            // point every node in the path away from the accessed way
+            for (size_t node = way + _cfg._assoc; node > 1; node /= 2) {
+                uint64_t bit = static_cast<uint64_t>(1) << (node / 2);
+                _tree[set] = (node & 1) ? (_tree[set] & ~bit) : (_tree[set] | bit);
+            }
+            break;
+        case policy::random:
+            break;
+    }
+}
+
+void level::fill(size_t set, uint32_t tag, bool dirty, address_t pc)
+{
+    size_t way = victim(set);
+    size_t i = set * _cfg._assoc + way;
+
+    if (_tags[i] != invalid) {
+        _stats._evictions++;
+        if (_dirty[i]) {
+            _stats._writebacks++;
+            if (_next) {
+                _next->access(_tags[i] << _line_bits, true, pc);
+            }
+        }
+    }
+
+    _tags[i] = tag;
+    _dirty[i] = dirty;
+    touch(set, way);
+}
+
+bool level::access(address_t addr, bool write, address_t pc)
+{
+    uint32_t tag = addr >> _line_bits;
+    size_t set = tag & (_sets - 1);
+
+    (write ? _stats._writes : _stats._reads)++;
+
+    size_t way = find(set, tag);
+    if (way != _cfg._assoc) {
+        touch(set, way);
+        if (write) {
+            if (_cfg._write_back) {
+                _dirty[set * _cfg._assoc + way] = 1;
+            } else if (_next) {
+                _next->access(addr, true, pc);
+            }
+        }
+        return true;
+    }
+
+    (write ? _stats._write_misses : _stats._read_misses)++;
+    _pc_misses[pc]++;
+
+    if (write && !_cfg._write_back) {
+        // no write allocate
+        if (_next) {
+            _next->access(addr, true, pc);
+        }
+        return false;
+    }
+
+    if (_next) {
+        _next->access(addr, false, pc);
+    }
+    fill(set, tag, write, pc);
+    return false;
+}
+
+void level::reset_stats()
+{
+    _stats = stats();
+    _pc_misses.clear();
+}
+
+hierarchy::hierarchy(const std::vector<config>& cfgs) :
+    _levels(), _l1i(nullptr), _l1d(nullptr), _pc(0)
+{
+    // the L2, if any, has to exist before the L1s point to it
+    level* l2 = nullptr;
+    for (const config& cfg : cfgs) {
+        if (cfg._name == "l2") {
+            _levels.push_back(std::make_unique<level>(cfg, nullptr));
+            l2 = _levels.back().get();
+        }
+    }
+    for (const config& cfg : cfgs) {
+        if (cfg._name == "l1i" || cfg._name == "l1d") {
+            _levels.insert(_levels.begin(), std::make_unique<level>(cfg, l2));
+            (cfg._name == "l1i" ? _l1i : _l1d) = _levels.front().get();
+        }
+    }
+}
+
+void hierarchy::reset_stats()
+{
+    for (auto& l : _levels) {
+        l->reset_stats();
+    }
+}
+
+void hierarchy::report(std::ostream& os, const memory& mem) const
+{
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+    };
+
+    os << std::dec << std::fixed << std::setprecision(2)
+       << "Cache    accesses      misses  miss%    evictions  writebacks" << std::endl;
+    for (const auto& l : _levels) {
+        const stats& st = l->get_stats();
+        os << std::left << std::setw(5) << l->cfg()._name << std::right
+           << std::setw(12) << st.accesses() << std::setw(12) << st.misses()
+           << std::setw(7) << percent(st.misses(), st.accesses())
+           << std::setw(13) << st._evictions << std::setw(12) << st._writebacks << std::endl;
+    }
+
+    for (const auto& l : _levels) {
+        std::vector<std::pair<uint64_t, address_t>> hot;
+        for (auto [pc, n] : l->pc_misses()) {
+            hot.emplace_back(n, pc);
+        }
+        std::sort(hot.rbegin(), hot.rend());
+        hot.resize(std::min<size_t>(hot.size(), 10));
+        if (hot.empty()) {
+            continue;
+        }
+
+        os << l->cfg()._name << " misses by pc:" << std::endl;
+        for (auto [n, pc] : hot) {
+            os << std::setw(12) << n << "  0x" << std::hex << std::setw(8) << std::setfill('0')
+               << pc << std::dec << std::setfill(' ') << "  " << mem.symbol_name(pc) << std::endl;
+        }
+    }
+    os.unsetf(std::ios::floatfield);
+}
+
+static size_t parse_size(const std::string& s)
+{
+    size_t end = 0;
+    size_t n = std::stoul(s, &end);
+    if (end < s.size()) {
+        switch (s[end]) {
+            case 'k': case 'K': n *= 1024; break;
+            case 'm': case 'M': n *= 1024 * 1024; break;
+        }
+    }
+    return n;
+}
+
+std::vector<config> cache::parse(const std::string& spec)
+{
+    std::vector<config> cfgs = {
+        {"l1i", 32 * 1024, 8, 64, policy::lru, true},
+        {"l1d", 32 * 1024, 8, 64, policy::lru, true},
+        {"l2", 256 * 1024, 8, 64, policy::lru, true},
+    };
+
+    std::istringstream levels(spec);
+    std::string item;
+    while (std::getline(levels, item, ',')) {
+        auto eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        auto it = std::find_if(cfgs.begin(), cfgs.end(),
+                [&name](const config& c) { return c._name == name; });
+        if (eq == std::string::npos || it == cfgs.end()) {
+            std::cerr << "Invalid cache level: " << item << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (item.substr(eq + 1) == "none" && name == "l2") {
+            cfgs.erase(it);
+            continue;
+        }
+
+        std::istringstream fields(item.substr(eq + 1));
+        std::string size, assoc, line, repl, write;
+        std::getline(fields, size, ':');
+        std::getline(fields, assoc, ':');
+        std::getline(fields, line, ':');
+        std::getline(fields, repl, ':');
+        std::getline(fields, write, ':');
+        try {
+            it->_size = parse_size(size);
+            it->_assoc = std::stoul(assoc);
+            it->_line = std::stoul(line);
+        } catch (const std::exception&) {
+            std::cerr << "Invalid cache level: " << item << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (repl == "plru") {
+            it->_policy = policy::plru;
+        } else if (repl == "random") {
+            it->_policy = policy::random;
+        } else if (!repl.empty() && repl != "lru") {
+            std::cerr << "Invalid replacement policy: " << repl << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        it->_write_back = write != "wt";
+    }
+    return cfgs;
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <string>
+
+#include <callstack.hh>
+#include <instructions.hh>
+
+using namespace prof;
+using namespace mem;
+
+callstack::callstack(address_t entry) : _nodes(), _stack(), _children(), _last_retired(0)
+{
+    _nodes.push_back(node{entry, 0, 0});
+    _stack.push_back(frame{0, 0});
+}
+
+void callstack::charge(uint64_t retired)
+{
+    _nodes[_stack.back()._node]._self += retired - _last_retired;
+    _last_retired = retired;
+}
+
+uint32_t callstack::child(uint32_t parent, address_t func)
+{
+    uint64_t key = (static_cast<uint64_t>(parent) << 32) | func;
+    auto [it, inserted] = _children.try_emplace(key, static_cast<uint32_t>(_nodes.size()));
+    if (inserted) {
+        _nodes.push_back(node{func, parent, 0});
+    }
+    return it->second;
+}
+
+void callstack::on_jump(uint32_t bitstream, address_t pc, address_t target,
+        uint64_t retired)
+{
+    // rd and rs1 share the same position in the J and I formats
+    instrs::i_instruction ii{bitstream};
+    bool is_jalr = ii.opcode() == 0b1100111;
+
+    if (is_link(ii.rd())) {
+        // the jump itself belongs to the caller
+        charge(retired);
+        _stack.push_back(frame{child(_stack.back()._node, target), pc + 4});
+    } else if (is_jalr && ii.rd() == 0 && is_link(ii.rs1())) {
+        charge(retired);
+        // unwind to the matching frame, so longjmp-like returns that skip
+        // several frames keep the stack consistent
+        auto it = std::find_if(_stack.rbegin(), _stack.rend() - 1,
+                [target](const frame& f) { return f._return_address == target; });
+        if (it != _stack.rend() - 1) {
+            _stack.erase(std::prev(it.base()), _stack.end());
+        }
+    }
+}
+
+void callstack::write_folded(std::ostream& os, const memory& mem, uint64_t retired)
+{
+    charge(retired);
+
+    std::vector<std::string> names;
+    names.reserve(_nodes.size());
+    for (const node& n : _nodes) {
+        names.push_back(mem.symbol_name(n._func));
+    }
+
+    std::vector<uint32_t> path;
+    for (uint32_t i = 0; i < _nodes.size(); ++i) {
+        if (_nodes[i]._self == 0) {
+            continue;
+        }
+
+        path.clear();
+        for (uint32_t n = i; n != 0; n = _nodes[n]._parent) {
+            path.push_back(n);
+        }
+        path.push_back(0);
+
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            os << (it == path.rbegin() ? "" : ";") << names[*it];
+        }
+        os << ' ' << _nodes[i]._self << '\n';
+    }
+}
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cstring>
+
+#include <checkpoint.hh>
+
+using namespace ckpt;
+using namespace mem;
+
+checkpoint ckpt::take(memory& mem, const processor& proc, uint64_t retired,
+        const checkpoint* prev)
+{
+    checkpoint c;
+    c._retired = retired;
+    c._pc = proc.read_pc();
+    for (size_t i = 0; i < c._regs.size(); ++i) {
+        c._regs[i] = proc.read_reg(i);
+    }
+
+    const auto& segments = mem.segments();
+    c._pages.resize(segments.size());
+    std::vector<bool> shared(segments.size(), false);
+    for (size_t s = 0; s < segments.size(); ++s) {
+        const uint8_t* content = segments[s].data();
+        size_t size = segments[s].size();
+        c._bases.push_back(segments[s]._initial_address);
+        c._mapped.push_back(segments[s]._mapped);
+        if (prev && s < prev->_pages.size() && prev->_bases[s] == segments[s]._initial_address
+                && prev->_pages[s].size() == segments[s].pages()) {
+            // start from the previous pages, the dirty ones are replaced below
+            c._pages[s] = prev->_pages[s];
+            shared[s] = true;
+            continue;
+        }
+        for (size_t off = 0; off < size; off += page_size) {
+            size_t len = std::min(page_size, size - off);
+            c._pages[s].push_back(std::make_shared<const page>(content + off, content + off + len));
+        }
+    }
+
+    mem.for_each_dirty([&](size_t s, size_t p) {
+        if (!shared[s]) {
+            return;
+        }
+        const uint8_t* content = segments[s].data();
+        size_t off = p * page_size;
+        size_t len = std::min(page_size, segments[s].size() - off);
+        c._pages[s][p] = std::make_shared<const page>(content + off, content + off + len);
+    });
+    mem.clear_dirty();
+    return c;
+}
+
+void ckpt::restore(const checkpoint& c, memory& mem, processor& proc)
+{
+    proc.write_pc(c._pc);
+    for (size_t i = 1; i < c._regs.size(); ++i) {
+        proc.write_reg(i, c._regs[i]);
+    }
+
+    // segments added or removed since the checkpoint go back to its layout;
+    // host mappings are replaced by copies so a MAP_SHARED file is never
+    // written back
+    auto& segments = mem.segments();
+    segments.resize(c._pages.size());
+    for (size_t s = 0; s < c._pages.size(); ++s) {
+        if (segments[s]._map) {
+            segments[s] = segment(c._bases[s], 0);
+        }
+        auto& content = segments[s]._content;
+        size_t size = 0;
+        for (const auto& pg : c._pages[s]) {
+            size += pg->size();
+        }
+        segments[s]._initial_address = c._bases[s];
+        segments[s]._mapped = c._mapped[s];
+        if (content.size() != size) {
+            content.resize(size);
+            segments[s].reset_bitmaps();
+        }
+        size_t off = 0;
+        for (const auto& pg : c._pages[s]) {
+            std::memcpy(&content[off], pg->data(), pg->size());
+            off += pg->size();
+        }
+    }
+    mem.clear_dirty();
+}
@@ -0,0 +1,235 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <aot.hh>
+#include <codecache.hh>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace codecache;
+using namespace mem;
+
+namespace {
+
+constexpr char cache_magic[8] = "RVCODE";
+
+struct cache_header {
+    char _magic[8];
+    uint32_t _version;
+    uint32_t _reserved;
+    uint64_t _key;
+    uint64_t _records;
+};
+
+// fields of an ir::block besides its nodes, which are stored raw
+struct block_header {
+    mem::address_t _pc;
+    uint32_t _length;
+    uint32_t _nodes;
+    uint8_t _ending;
+    uint8_t _cond;
+    uint16_t _reserved;
+    uint32_t _a;
+    uint32_t _b;
+    mem::address_t _last;
+    mem::address_t _target;
+    mem::address_t _next;
+};
+
+struct record_header {
+    mem::address_t _pc;
+    uint32_t _instrs;
+    uint8_t _code;
+    uint8_t _superblock;
+    uint16_t _steps; // of the superblock, each a step_header and its bitstreams
+};
+
+struct step_header {
+    mem::address_t _pc;
+    uint32_t _instrs;
+};
+
+template<typename T>
+void put(std::vector<uint8_t>& out, const T& val)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&val);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+void put_block(std::vector<uint8_t>& out, const ir::block& b)
+{
+    put(out, block_header{b._pc, b._length, static_cast<uint32_t>(b._nodes.size()),
+            static_cast<uint8_t>(b._ending), b._cond, 0, b._a, b._b, b._last, b._target, b._next});
+    for (const ir::node& n : b._nodes) {
+        put(out, n);
+    }
+}
+
+} // namespace
+
+uint64_t codecache::key(const memory& mem, const instrs::features& f)
+{
+    // the nodes are stored raw, their layout is part of the format; the IR
+    // runs the instructions the handlers of f left legal, like mul
+    uint64_t hash = aot::text_hash(mem);
+    for (uint64_t v : {uint64_t(version), uint64_t(sizeof(ir::node)), uint64_t(sizeof(block_header)),
+                uint64_t(f._rv32m), uint64_t(f._alignment)}) {
+        hash = (hash ^ v) * 0x100000001b3;
+    }
+    return hash;
+}
+
+std::string codecache::path(const std::string& dir, const memory& mem, const instrs::features& f)
+{
+    std::ostringstream os;
+    os << dir << "/" << std::hex << key(mem, f) << ".rvcc";
+    return os.str();
+}
+
+writer::writer() : _out(sizeof(cache_header)), _records(0) {}
+
+void writer::add(address_t pc, const std::vector<uint32_t>& bitstreams,
+        const ir::block* code, const ir::block* superblock, const std::vector<ir::step>& path)
+{
+    put(_out, record_header{pc, static_cast<uint32_t>(bitstreams.size()),
+            code != nullptr, superblock != nullptr,
+            static_cast<uint16_t>(superblock ? path.size() : 0)});
+    for (uint32_t bitstream : bitstreams) {
+        put(_out, bitstream);
+    }
+    if (code) {
+        put_block(_out, *code);
+    }
+    if (superblock) {
+        put_block(_out, *superblock);
+        for (const ir::step& st : path) {
+            put(_out, step_header{st._pc, static_cast<uint32_t>(st._bitstreams.size())});
+            for (uint32_t bitstream : st._bitstreams) {
+                put(_out, bitstream);
+            }
+        }
+    }
+    ++_records;
+}
+
+void writer::save(const std::string& file, const memory& mem, const instrs::features& f) const
+{
+    cache_header header{};
+    std::memcpy(header._magic, cache_magic, sizeof(cache_magic));
+    header._version = version;
+    header._key = key(mem, f);
+    header._records = _records;
+
+    std::string tmp = file + "." + std::to_string(::getpid());
+    std::FILE* out = std::fopen(tmp.c_str(), "wb");
+    if (out == nullptr || std::fwrite(&header, sizeof(header), 1, out) != 1
+            || std::fwrite(_out.data() + sizeof(header), 1, _out.size() - sizeof(header), out)
+                != _out.size() - sizeof(header)
+            || std::fclose(out) != 0 || std::rename(tmp.c_str(), file.c_str()) != 0) {
+        std::cerr << "Unable to write code cache " << file << std::endl;
+        std::remove(tmp.c_str());
+    }
+}
+
+reader::reader(const std::string& file, const memory& mem, const instrs::features& f) : _map(), _pos(0), _left(0)
+{
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(cache_header)) {
+        size_t len = static_cast<size_t>(st.st_size);
+        void* p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            _map = std::make_unique<mapping>(static_cast<uint8_t*>(p), len);
+        }
+    }
+    ::close(fd);
+    if (!_map) {
+        return;
+    }
+
+    cache_header header;
+    std::memcpy(&header, _map->_addr, sizeof(header));
+    if (std::memcmp(header._magic, cache_magic, sizeof(cache_magic)) == 0
+            && header._version == version && header._key == key(mem, f)) {
+        _pos = sizeof(header);
+        _left = header._records;
+    }
+}
+
+bool reader::next(record& r)
+{
+    auto take = [this](void* dst, size_t len) {
+        if (_map->_length - _pos < len) {
+            return false;
+        }
+        std::memcpy(dst, _map->_addr + _pos, len);
+        _pos += len;
+        return true;
+    };
+    auto take_block = [this, &take](std::unique_ptr<ir::block>& b) {
+        block_header h;
+        if (!take(&h, sizeof(h))) {
+            return false;
+        }
+        b = std::make_unique<ir::block>();
+        b->_pc = h._pc;
+        b->_length = h._length;
+        b->_ending = static_cast<ir::ending>(h._ending);
+        b->_cond = h._cond;
+        b->_a = h._a;
+        b->_b = h._b;
+        b->_last = h._last;
+        b->_target = h._target;
+        b->_next = h._next;
+        if (h._nodes > (_map->_length - _pos) / sizeof(ir::node)) {
+            return false;
+        }
+        b->_nodes.resize(h._nodes);
+        b->_values.resize(h._nodes);
+        return take(b->_nodes.data(), h._nodes * sizeof(ir::node)) && ir::valid(*b);
+    };
+    auto take_bitstreams = [this, &take](std::vector<uint32_t>& bitstreams, uint32_t instrs) {
+        if (instrs > (_map->_length - _pos) / sizeof(uint32_t)) {
+            return false;
+        }
+        bitstreams.resize(instrs);
+        return take(bitstreams.data(), instrs * sizeof(uint32_t));
+    };
+
+    if (_left == 0) {
+        return false;
+    }
+    --_left;
+
+    record_header h;
+    if (!take(&h, sizeof(h))) {
+        return false;
+    }
+    r._pc = h._pc;
+    r._code.reset();
+    r._superblock.reset();
+    r._path.clear();
+    if (!take_bitstreams(r._bitstreams, h._instrs)
+            || (h._code && !take_block(r._code))
+            || (h._superblock && !take_block(r._superblock))) {
+        return false;
+    }
+    for (uint16_t s = 0; s < h._steps; ++s) {
+        step_header sh;
+        r._path.push_back(ir::step{0, {}});
+        if (!take(&sh, sizeof(sh)) || !take_bitstreams(r._path.back()._bitstreams, sh._instrs)) {
+            return false;
+        }
+        r._path.back()._pc = sh._pc;
+    }
+    return true;
+}
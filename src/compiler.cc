@@ -0,0 +1,60 @@
+#include <compiler.hh>
+
+using namespace engine;
+
+void compilation::run()
+{
+    std::unique_ptr<ir::block> b = ir::lower_trace(_steps);
+    if (b) {
+        ir::optimise(*b);
+        _code.store(b.release(), std::memory_order_release);
+    }
+    _steps = std::vector<ir::step>();
+}
+
+compiler::compiler(unsigned threads) : _lock(), _wake(), _queue(), _stop(false), _workers()
+{
+    for (unsigned i = 0; i < threads; ++i) {
+        _workers.emplace_back(&compiler::work, this);
+    }
+}
+
+compiler::~compiler()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& t : _workers) {
+        t.join();
+    }
+}
+
+void compiler::submit(std::shared_ptr<compilation> c)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _queue.push_back(std::move(c));
+    }
+    _wake.notify_one();
+}
+
+void compiler::work()
+{
+    for (;;) {
+        std::shared_ptr<compilation> c;
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _wake.wait(guard, [this] { return _stop || !_queue.empty(); });
+            if (_stop) {
+                return;
+            }
+            c = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        if (c.use_count() > 1) {
+            c->run();
+        }
+    }
+}
@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+
+#include <engine.hh>
+#include <instructions.hh>
+
+using namespace engine;
+using namespace mem;
+
+static uint32_t illegal(memory&, processor& proc, uint32_t bitstream)
+{
+    std::cerr << "Unknown instruction 0x" << std::hex << bitstream << " at pc 0x"
+              << proc.read_pc() << std::dec << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+deadline::deadline(std::chrono::duration<double> limit) :
+    _expired(false), _lock(), _cancel(), _done(false), _timer()
+{
+    auto until = std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(limit);
+    _timer = std::thread([this, until] {
+        std::unique_lock<std::mutex> guard(_lock);
+        if (!_cancel.wait_until(guard, until, [this] { return _done; })) {
+            _expired.store(true, std::memory_order_relaxed);
+        }
+    });
+}
+
+deadline::~deadline()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _done = true;
+    }
+    _cancel.notify_one();
+    _timer.join();
+}
+
+template<instrs::features F>
+static handler decode(uint32_t bitstream)
+{
+    switch (bitstream & 0x7F) {
+        case 0b0000011: return instrs::load<F>;
+        case 0b0100011: return instrs::store<F>;
+        case 0b0010011: return instrs::alui;
+        case 0b0110011: return F._rv32m || (bitstream >> 25) != 0b0000001 ? instrs::alur : illegal;
+        case 0b0110111: return instrs::lui;
+        case 0b1101111: return instrs::jal;
+        case 0b1100111: return instrs::jalr;
+        case 0b1100011: return instrs::condbranch;
+        case 0b1110011: return instrs::system;
+    }
+    return illegal;
+}
+
+template<size_t... I>
+static constexpr std::array<decoder, sizeof...(I)> decoders(std::index_sequence<I...>)
+{
+    return {decode<instrs::configuration(I)>...};
+}
+
+decoder engine::select(const instrs::features& f)
+{
+    constexpr auto table = decoders(std::make_index_sequence<instrs::configurations>());
+    return table[instrs::index(f)];
+}
+
+result engine::run_reference(memory& mem, processor& proc, const models& m,
+        uint64_t& retired, uint64_t max)
+{
+    address_t pc = 0xDEADBEEF, next_pc = 0xDEADBEEF;
+    uint64_t start = retired;
+    analysis::event* rec = nullptr;
+    instrs::features f = m._features;
+    f._observed = mem.observed();
+    decoder decode = select(f);
+
+    do
+    {
+        // native calls may retire more than one instruction
+        if (retired - start >= max) {
+            return result{status::limit, retired - start, proc.read_pc()};
+        }
+
+        // main interpreter loop
+        pc = proc.read_pc();
+        const intercept::routine* native = m._natives ? m._natives->find(pc) : nullptr;
+        if (native && m._natives->cost(*native, mem, proc) > max - (retired - start)) {
+            native = nullptr;
+        }
+        uint32_t instr = native ? intercept::ret : mem.fetch(pc);
+
+        if (m._sampler) {
+            prof::sampler::publish(pc, instr & 0x7F, native ? prof::tier::native : prof::tier::interpreter);
+            m._counts->add(pc);
+            if ((retired & 0xFFFFF) == 0) {
+                m._sampler->drain();
+            }
+        }
+
+        if (m._verbose) {
+            std::cout << "Reading instrucion" << std::endl;
+        }
+
+        if (m._events) {
+            rec = &m._events->next();
+            trace::capture(proc, pc, native ? intercept::ret_a0 : instr, *rec);
+        }
+
+        uint64_t count = 1;
+        if (native) {
+            count = m._natives->call(*native, mem, proc);
+            next_pc = proc.read_pc();
+        } else {
+            next_pc = decode(instr)(mem, proc, instr);
+        }
+
+        if (m._events) {
+            trace::complete(proc, mem, *rec);
+        }
+
+        proc.write_pc(next_pc);
+        retired += count;
+
+        if (m._pipeline) {
+            m._pipeline->retire(instr, pc, next_pc);
+        }
+
+        // jal and jalr share all the opcode bits but bit 3
+        if (m._calls && (instr & 0x77) == 0b1100111) {
+            m._calls->on_jump(instr, pc, next_pc, retired);
+        }
+
+        // and branches only differ from them in bits 2 and 3
+        if (m._branches && (instr & 0x73) == 0b1100011) {
+            m._branches->on_control(instr, pc, next_pc);
+        }
+
+        if (m._stop && next_pc != pc + 4 && next_pc != pc
+                && m._stop->load(std::memory_order_relaxed)) {
+            return result{status::deadline, retired - start, next_pc};
+        }
+    } while (next_pc != pc); // look for while(1) in the code
+
+    return result{status::halted, retired - start, pc};
+}
+
+block_engine::block* block_engine::translate(memory& mem, address_t pc)
+{
+    auto& b = _blocks[pc];
+    if (b) {
+        return b.get();
+    }
+
+    b = std::make_unique<block>();
+    b->_pc = pc;
+    // the guest code is decoded too, for calls over the budget
+    if (_natives) {
+        b->_native = _natives->find(pc);
+    }
+    // translated blocks may end earlier, at the start of another one
+    const aot::entry* compiled = _translation ? _translation->find(pc) : nullptr;
+    for (address_t i = 0; compiled && i < compiled->_length; ++i) {
+        if (_rewritten.contains(pc + 4 * i)) {
+            compiled = nullptr;
+        }
+    }
+    size_t limit = compiled ? compiled->_length : max_block;
+    for (address_t addr = pc; b->_instrs.size() < limit; addr += 4) {
+        // code may end with its segment, the first fetch fails as usual
+        if (addr != pc && mem.find_segment(addr) == -1) {
+            break;
+        }
+        uint32_t bitstream = mem.peek<uint32_t>(addr);
+        mem.mark_code(addr);
+        b->_instrs.push_back(decoded{_decode(bitstream), bitstream});
+
+        // jal, jalr and branches end the block
+        if ((bitstream & 0x73) == 0b1100011) {
+            break;
+        }
+    }
+    // the optimised forms run what the features may have left out, like mul
+    bool legal = std::none_of(b->_instrs.begin(), b->_instrs.end(),
+            [](const decoded& d) { return d._fn == illegal; });
+    if (compiled && legal && b->_instrs.size() == compiled->_length) {
+        b->_compiled = compiled->_fn;
+    }
+
+    if (legal) {
+        ir::step st{pc, {}};
+        for (const decoded& d : b->_instrs) {
+            st._bitstreams.push_back(d._bitstream);
+        }
+        b->_ir = compile({std::move(st)});
+    }
+    analyse(*b);
+    return b.get();
+}
+
+std::shared_ptr<compilation> block_engine::compile(std::vector<ir::step> steps)
+{
+    auto c = std::make_shared<compilation>(std::move(steps));
+    if (_compiler) {
+        _compiler->submit(c);
+    } else {
+        c->run();
+    }
+    return c;
+}
+
+void block_engine::extend_trace(block* b)
+{
+    block* head = _trace.front();
+    if (b != head) {
+        if (b->_native || _trace_length + b->_instrs.size() > max_trace) {
+            head->_traced = true;
+            _trace.clear();
+        } else {
+            _trace.push_back(b);
+            _trace_length += b->_instrs.size();
+        }
+        return;
+    }
+
+    // back at the head; a loop of one block already runs once per iteration
+    if (_trace.size() > 1) {
+        std::vector<ir::step> steps;
+        for (const block* t : _trace) {
+            ir::step st{t->_pc, {}};
+            for (const decoded& d : t->_instrs) {
+                st._bitstreams.push_back(d._bitstream);
+            }
+            steps.push_back(std::move(st));
+        }
+        head->_superblock = compile(steps);
+        head->_path = std::move(steps);
+        ++_superblocks;
+    }
+    head->_traced = true;
+    _trace.clear();
+}
+
+void block_engine::analyse(block& b)
+{
+    uint32_t last = b._instrs.back()._bitstream;
+    address_t last_pc = b._pc + 4 * static_cast<address_t>(b._instrs.size() - 1);
+    bool branch = (last & 0x7F) == 0b1100011;
+    if (branch) {
+        b._loop = last_pc + instrs::b_instruction{last}.imm() == b._pc;
+    } else if ((last & 0x7F) == 0b1101111) {
+        instrs::j_instruction ji{last};
+        b._loop = ji.rd() == 0 && last_pc + ji.imm() == b._pc;
+    }
+    if (!b._loop) {
+        return;
+    }
+
+    b._affine = branch;
+    for (size_t i = 0; i + 1 < b._instrs.size(); ++i) {
+        uint32_t bitstream = b._instrs[i]._bitstream;
+        instrs::i_instruction ii{bitstream};
+        switch (bitstream & 0x7F) {
+            case 0b0010011: // alui
+            case 0b0110011: // alur
+            case 0b0110111: // lui
+            case 0b0000011: // load
+                break;
+            default:
+                b._loop = false;
+                return;
+        }
+        if (ii.rd() == 0) {
+            continue;
+        }
+        b._writes |= 1u << ii.rd();
+
+        if ((bitstream & 0x707F) == 0b0010011 && ii.rs1() == ii.rd()) { // addi r, r, imm
+            auto it = std::find_if(b._steps.begin(), b._steps.end(),
+                    [&ii](const auto& st) { return st.first == ii.rd(); });
+            if (it == b._steps.end()) {
+                b._steps.emplace_back(ii.rd(), ii.imm());
+            } else {
+                it->second += ii.imm();
+            }
+        } else {
+            b._affine = false;
+        }
+    }
+
+    // the branch compares exactly one induction register with an invariant
+    if (b._affine) {
+        instrs::b_instruction bi{last};
+        bool w1 = b._writes & (1u << bi.rs1());
+        bool w2 = b._writes & (1u << bi.rs2());
+        b._affine = w1 != w2;
+    }
+}
+
+uint64_t block_engine::iterations(const block& b, const processor& proc)
+{
+    instrs::b_instruction bi{b._instrs.back()._bitstream};
+    bool left = b._writes & (1u << bi.rs1());
+    uint8_t r = left ? bi.rs1() : bi.rs2();
+    uint32_t c = proc.read_reg(left ? bi.rs2() : bi.rs1());
+    uint32_t v = proc.read_reg(r);
+    uint32_t step = 0;
+    for (const auto& st : b._steps) {
+        if (st.first == r) {
+            step = st.second;
+        }
+    }
+
+    // the branch of iteration m sees v + m * step
+    if (bi.funct3() == 0b001) { // bne: solve m * step == c - v modulo 2^32
+        uint32_t d = c - v;
+        if (step == 0) {
+            return d == 0 ? 1 : forever;
+        }
+        int t = std::countr_zero(step);
+        if (d != 0 && std::countr_zero(d) < t) {
+            return forever;
+        }
+        uint32_t odd = step >> t;
+        uint32_t inv = odd; // Newton iterations for the inverse modulo 2^32
+        for (int i = 0; i < 5; ++i) {
+            inv *= 2 - odd * inv;
+        }
+        uint64_t period = uint64_t(1) << (32 - t);
+        uint64_t m = static_cast<uint32_t>((d >> t) * inv) % period;
+        return m == 0 ? period : m;
+    }
+    if (bi.funct3() == 0b000) { // beq, at most one iteration unless it never exits
+        return step == 0 && v + step == c ? forever : 1;
+    }
+
+    // ordered comparisons in 64 bits, valid while the value does not wrap
+    bool is_signed = bi.funct3() == 0b100 || bi.funct3() == 0b101;
+    bool less = bi.funct3() == 0b100 || bi.funct3() == 0b110; // blt, bltu
+    int64_t x = is_signed ? int64_t(int32_t(v)) : int64_t(v);
+    int64_t k = is_signed ? int64_t(int32_t(c)) : int64_t(c);
+    int64_t s = int32_t(step);
+    int64_t lo = is_signed ? INT32_MIN : 0;
+    int64_t hi = is_signed ? INT32_MAX : int64_t(UINT32_MAX);
+
+    // the loop goes on while x <= upper or while x >= lower
+    bool upper;
+    int64_t bound;
+    if (left) {
+        upper = less;
+        bound = less ? k - 1 : k; // x < c, or x >= c
+    } else {
+        upper = !less;
+        bound = less ? k + 1 : k; // c < x, or c >= x
+    }
+
+    int64_t m;
+    if (upper && s > 0) {
+        m = bound < x + s ? 1 : (bound - x) / s + 1;
+    } else if (!upper && s < 0) {
+        m = bound > x + s ? 1 : (x - bound) / -s + 1;
+    } else {
+        return unknown;
+    }
+    int64_t exit = x + m * s;
+    return exit < lo || exit > hi ? unknown : static_cast<uint64_t>(m);
+}
+
+result block_engine::run(memory& mem, processor& proc, uint64_t& retired, uint64_t max)
+{
+    configure_for(mem);
+    uint64_t start = retired;
+    address_t pc = proc.read_pc();
+    address_t prev = 0; // start of the last block
+    bool misaligned = false; // the optimised forms left the access at pc to the handlers
+    uint64_t drained = retired >> 20;
+
+    while (retired - start < max) {
+        if (_stop && _stop->load(std::memory_order_relaxed)) {
+            return result{status::deadline, retired - start, pc};
+        }
+        if (_sampler && (retired >> 20) != drained) {
+            _sampler->drain();
+            drained = retired >> 20;
+        }
+
+        if (mem.code_written()) {
+            invalidate(mem);
+        }
+
+        block* b = find(mem, pc);
+        bool backward = pc <= prev;
+        prev = pc;
+        bool single = std::exchange(misaligned, false);
+
+        // trace the path from loop heads once they are hot
+        if (!_trace.empty()) {
+            extend_trace(b);
+        } else if (backward && !b->_native && !b->_traced && !b->_compiled && ++b->_heat == hot) {
+            _trace.push_back(b);
+            _trace_length = b->_instrs.size();
+        }
+
+        const ir::block* super = b->_superblock ? b->_superblock->code() : nullptr;
+        if (super && !single && _trace.empty() && !mem.observed()
+                && super->_length <= max - (retired - start)) {
+            uint64_t before = retired;
+            if (_sampler) {
+                prof::sampler::publish(pc, b->_instrs.front()._bitstream & 0x7F, prof::tier::ir);
+            }
+            ir::outcome out = ir::run(*super, mem, proc, retired);
+            if (_sampler) {
+                count(*b, true, retired - before);
+            }
+            proc.write_pc(out._next);
+            if (out._halted) {
+                return result{status::halted, retired - start, out._next};
+            }
+            pc = out._next;
+            misaligned = out._misaligned;
+            continue;
+        }
+
+        if (b->_native && _natives->cost(*b->_native, mem, proc) <= max - (retired - start)) {
+            if (_sampler) {
+                prof::sampler::publish(pc, intercept::ret & 0x7F, prof::tier::native);
+                _counts->add(pc);
+            }
+            retired += _natives->call(*b->_native, mem, proc);
+            pc = proc.read_pc();
+            continue;
+        }
+
+        // loops: skip to the last iteration, or watch for one that changes
+        // nothing and would spin forever; the observers see every iteration
+        bool spin = false;
+        std::array<uint32_t, 32> before;
+        if (b->_loop && !single && !_decoded._observed) {
+            uint64_t count = b->_affine ? iterations(*b, proc) : unknown;
+            if (count == forever && _endless) {
+                return result{status::halted, retired - start, pc};
+            }
+            uint64_t len = b->_instrs.size();
+            uint64_t skip = std::min(count, (max - (retired - start)) / len);
+            if (skip > 1) {
+                for (const auto& [reg, step] : b->_steps) {
+                    proc.write_reg(reg, proc.read_reg(reg) + static_cast<uint32_t>(skip - 1) * step);
+                }
+                retired += (skip - 1) * len;
+                _skipped += (skip - 1) * len;
+                if (_sampler) {
+                    for (uint64_t i = 0; i < len; ++i) {
+                        _counts->add(b->_pc + 4 * static_cast<address_t>(i), skip - 1);
+                    }
+                }
+            }
+            spin = _endless && count == unknown;
+            for (uint32_t w = b->_writes; spin && w != 0; w &= w - 1) {
+                before[std::countr_zero(w)] = proc.read_reg(std::countr_zero(w));
+            }
+        }
+
+        size_t n = std::min<uint64_t>(single ? 1 : b->_instrs.size(), max - (retired - start));
+
+        // the optimised forms skip memory accesses the observers would see
+        const ir::block* code = b->_ir ? b->_ir->code() : nullptr;
+        if (!single && n == b->_instrs.size() && (b->_compiled || code) && !mem.observed()) {
+            uint64_t before = retired;
+            if (_sampler) {
+                prof::sampler::publish(pc, b->_instrs.front()._bitstream & 0x7F,
+                        b->_compiled ? prof::tier::compiled : prof::tier::ir);
+            }
+            ir::outcome out = b->_compiled ? b->_compiled(mem, proc, retired)
+                : ir::run(*code, mem, proc, retired);
+            if (_sampler) {
+                count(*b, false, retired - before);
+            }
+            proc.write_pc(out._next);
+            if (b->_compiled) {
+                _translated += retired - before;
+            }
+            if (out._halted) {
+                return result{status::halted, retired - start, out._next};
+            }
+            pc = out._next;
+            if (out._misaligned) {
+                misaligned = true;
+                continue;
+            }
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                const decoded& d = b->_instrs[i];
+                if (_sampler) {
+                    prof::sampler::publish(pc, d._bitstream & 0x7F, prof::tier::blocks);
+                    _counts->add(pc);
+                }
+                // the caches see the fetch like in the reference loop
+                if (_decoded._observed) {
+                    mem.fetch(pc);
+                }
+                address_t next_pc = d._fn(mem, proc, d._bitstream);
+                proc.write_pc(next_pc);
+                retired++;
+                if (next_pc == pc) {
+                    return result{status::halted, retired - start, pc};
+                }
+                pc = next_pc;
+                // the rest of the block may be what the store rewrote
+                if (mem.code_written()) {
+                    break;
+                }
+            }
+        }
+
+        if (spin && pc == b->_pc && n == b->_instrs.size()) {
+            bool same = true;
+            for (uint32_t w = b->_writes; same && w != 0; w &= w - 1) {
+                same = before[std::countr_zero(w)] == proc.read_reg(std::countr_zero(w));
+            }
+            if (same) {
+                return result{status::halted, retired - start, pc};
+            }
+        }
+    }
+    return result{status::limit, retired - start, pc};
+}
+
+void block_engine::count(const block& b, bool super, uint64_t n)
+{
+    if (!super) {
+        for (uint64_t i = 0; i < n; ++i) {
+            _counts->add(b._pc + 4 * static_cast<address_t>(i));
+        }
+        return;
+    }
+    // the steps run one after the other up to the side exit taken
+    for (const ir::step& st : b._path) {
+        for (size_t i = 0; i < st._bitstreams.size() && n > 0; ++i, --n) {
+            _counts->add(st._pc + 4 * static_cast<address_t>(i));
+        }
+    }
+}
+
+void block_engine::configure_for(const memory& mem)
+{
+    instrs::features f = _features;
+    f._observed = mem.observed();
+    if (f != _decoded) {
+        flush();
+        _decoded = f;
+        _decode = select(f);
+    }
+}
+
+void block_engine::invalidate(memory& mem)
+{
+    // too many writes to follow, decode everything again, without the
+    // translation of the code as loaded
+    const std::vector<code_write>* writes = mem.code_writes();
+    if (writes == nullptr) {
+        _translation = nullptr;
+        flush();
+        mem.clear_code();
+        return;
+    }
+
+    auto written = [writes](address_t begin, address_t end) {
+        return std::any_of(writes->begin(), writes->end(), [begin, end](const code_write& w) {
+            return w._addr < end && begin < w._addr + w._size;
+        });
+    };
+    size_t erased = std::erase_if(_blocks, [&written](const auto& entry) {
+        const block& b = *entry.second;
+        return written(b._pc, b._pc + 4 * static_cast<address_t>(std::max<size_t>(b._instrs.size(), 1)));
+    });
+    // a superblock may run blocks that were never decoded on their own,
+    // like the ones of the code cache
+    for (auto& [pc, b] : _blocks) {
+        bool stale = std::any_of(b->_path.begin(), b->_path.end(), [&written](const ir::step& st) {
+            return written(st._pc, st._pc + 4 * static_cast<address_t>(st._bitstreams.size()));
+        });
+        if (stale) {
+            b->_superblock = nullptr;
+            b->_path.clear();
+            b->_traced = false;
+            b->_heat = 0;
+        }
+    }
+    if (_translation) {
+        for (const code_write& w : *writes) {
+            for (address_t addr = w._addr & ~3u; addr < w._addr + w._size; addr += 4) {
+                _rewritten.insert(addr);
+            }
+        }
+    }
+    mem.clear_code_writes();
+    if (erased == 0) {
+        return; // data sharing a page with code
+    }
+    _trace.clear();
+    _lookup.fill(nullptr);
+}
+
+void block_engine::flush()
+{
+    _trace.clear();
+    _lookup.fill(nullptr);
+    _blocks.clear();
+}
+
+size_t block_engine::load(codecache::reader& in, memory& mem)
+{
+    if (_natives || _translation) {
+        return 0;
+    }
+    configure_for(mem);
+
+    // the key only covers the executable segments, and the optimised forms
+    // run what the handlers would reject
+    auto current = [this, &mem](const ir::step& st) {
+        for (size_t i = 0; i < st._bitstreams.size(); ++i) {
+            address_t addr = st._pc + 4 * static_cast<address_t>(i);
+            if (mem.find_segment(addr) == -1 || mem.peek<uint32_t>(addr) != st._bitstreams[i]
+                    || _decode(st._bitstreams[i]) == illegal) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    size_t loaded = 0;
+    codecache::record r;
+    while (in.next(r)) {
+        if (r._bitstreams.empty() || _blocks.contains(r._pc)) {
+            continue;
+        }
+        ir::step st{r._pc, std::move(r._bitstreams)};
+        if (!current(st)) {
+            continue;
+        }
+
+        auto b = std::make_unique<block>();
+        b->_pc = r._pc;
+        for (size_t i = 0; i < st._bitstreams.size(); ++i) {
+            mem.mark_code(r._pc + 4 * static_cast<address_t>(i));
+            b->_instrs.push_back(decoded{_decode(st._bitstreams[i]), st._bitstreams[i]});
+        }
+        // blocks still compiling when the earlier run ended are compiled again
+        b->_ir = r._code ? std::make_shared<compilation>(std::move(r._code))
+            : compile({std::move(st)});
+
+        // superblocks run the code of every step, which must be the same
+        size_t length = 0;
+        for (const ir::step& s : r._path) {
+            length += s._bitstreams.size();
+        }
+        if (r._superblock && !r._path.empty() && r._path.front()._pc == r._pc
+                && length == r._superblock->_length && std::all_of(r._path.begin(), r._path.end(), current)) {
+            for (const ir::step& s : r._path) {
+                for (size_t i = 0; i < s._bitstreams.size(); ++i) {
+                    mem.mark_code(s._pc + 4 * static_cast<address_t>(i));
+                }
+            }
+            b->_superblock = std::make_shared<compilation>(std::move(r._superblock));
+            b->_path = std::move(r._path);
+            b->_traced = true;
+        }
+        analyse(*b);
+        _blocks[r._pc] = std::move(b);
+        ++loaded;
+    }
+    return loaded;
+}
+
+void block_engine::save(codecache::writer& out) const
+{
+    for (const auto& [pc, b] : _blocks) {
+        if (b->_native) {
+            continue;
+        }
+        std::vector<uint32_t> bitstreams;
+        for (const decoded& d : b->_instrs) {
+            bitstreams.push_back(d._bitstream);
+        }
+        out.add(pc, bitstreams, b->_ir ? b->_ir->code() : nullptr,
+                b->_superblock ? b->_superblock->code() : nullptr, b->_path);
+    }
+}
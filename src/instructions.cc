@@ -1,62 +1,80 @@
+#include <cstdlib>
+#include <iostream>
+
 #include <instructions.hh>
 #include <memory.hh>
+#include <replay.hh>
+#include <syscalls.hh>
 using namespace instrs;
 using namespace mem;
 
-// ToDo use the type instead of RISC-V funct3 field?
-// assume little endian
-// LW 0b010
-template<>
-void instrs::execute_load<0b010>(mem::memory& mem, processor & proc,
-    mem::address_t addr, uint8_t rd)
-{
-  assert((addr & 0b11) == 0); // ensure alignment
-  proc.write_reg(rd, mem.read<uint32_t>(addr));
-}
-
-// LBU 100
-template<>
-void instrs::execute_load<0b100>(mem::memory& mem, processor & proc,
-    mem::address_t addr, uint8_t rd)
+const char* instrs::opcode_name(uint8_t opcode)
 {
-  // no sign extension
-  uint32_t val = mem.read<uint8_t>(addr);
-  proc.write_reg(rd, val);
+  switch(opcode) {
+    case 0b0000011: return "load";
+    case 0b0100011: return "store";
+    case 0b0010011: return "alui";
+    case 0b0110011: return "alur";
+    case 0b0110111: return "lui";
+    case 0b1101111: return "jal";
+    case 0b1100111: return "jalr";
+    case 0b1100011: return "branch";
+    case 0b1110011: return "system";
+  }
+  return "unknown";
 }
 
-// LB 000
-template<>
-void instrs::execute_load<0b000>(mem::memory& mem, processor & proc,
-    mem::address_t addr, uint8_t rd)
+// stop on a misaligned access, unless the checks are off
+[[noreturn]] static void misaligned(const char* kind, const processor& proc, address_t addr)
 {
-  uint32_t val = static_cast<uint32_t>(sign_extend<int32_t, sizeof(uint8_t)*8>(mem.read<uint8_t>(addr)));
-  proc.write_reg(rd, val);
+  std::cerr << "Misaligned " << kind << " at 0x" << std::hex << addr << " at pc 0x"
+            << proc.read_pc() << std::dec << std::endl;
+  std::exit(EXIT_FAILURE);
 }
 
-// LH
-template<>
-void instrs::execute_load<0b001>(mem::memory& mem, processor & proc,
-    mem::address_t addr, uint8_t rd)
+// assume little endian
+template<features F, typename T>
+static T read(memory& mem, const processor& proc, address_t addr)
 {
-  assert((addr & 0b1) == 0); // ensure alignment
-  // perform sign extension
-  uint32_t val = static_cast<uint32_t>(sign_extend<int32_t,
-           sizeof(uint16_t)*8>(mem.read<uint16_t>(addr)));
-  proc.write_reg(rd, val);
+  if constexpr (F._alignment) {
+    if (addr % sizeof(T) != 0) {
+      misaligned("load", proc, addr);
+    }
+  } else if (addr % sizeof(T) != 0) {
+    if constexpr (F._observed) {
+      mem.notify(addr, sizeof(T), access::read);
+    }
+    return mem.peek_misaligned<T>(addr);
+  }
+  if constexpr (F._observed) {
+    return mem.read<T>(addr);
+  } else {
+    return mem.peek<T>(addr);
+  }
 }
 
-// LHU
-template<>
-void instrs::execute_load<0b101>(mem::memory& mem, processor & proc,
-    mem::address_t addr, uint8_t rd)
+template<features F, typename T>
+static void write(memory& mem, const processor& proc, address_t addr, T value)
 {
-  assert((addr & 0b1) == 0); // ensure alignment
-  // perform sign extension
-  uint32_t val = mem.read<uint16_t>(addr);
-  proc.write_reg(rd, val);
+  if constexpr (F._alignment) {
+    if (addr % sizeof(T) != 0) {
+      misaligned("store", proc, addr);
+    }
+  } else if (addr % sizeof(T) != 0) {
+    if constexpr (F._observed) {
+      mem.notify(addr, sizeof(T), access::write);
+    }
+    mem.poke_misaligned<T>(addr, value);
+    return;
+  }
+  if constexpr (F._observed) {
+    mem.write<T>(addr, value);
+  } else {
+    mem.poke<T>(addr, value);
+  }
 }
 
-
+template<features F>
 uint32_t instrs::load(memory& mem, processor & proc, uint32_t bitstream) {
 
   i_instruction ii{bitstream};
@@ -64,42 +82,31 @@ uint32_t instrs::load(memory& mem, processor & proc, uint32_t bitstream) {
   // compute src address
   address_t src = proc.read_reg(ii.rs1()) + ii.imm();
 
-  // ToDo refactor with templates
+  uint32_t val;
   switch(ii.funct3()) {
-    case 0b010: execute_load<0b010>(mem, proc, src, ii.rd()); break;
-    case 0b000: execute_load<0b000>(mem, proc, src, ii.rd()); break;
-    case 0b001: execute_load<0b001>(mem, proc, src, ii.rd()); break;
-    case 0b100: execute_load<0b100>(mem, proc, src, ii.rd()); break;
-    case 0b101: execute_load<0b101>(mem, proc, src, ii.rd()); break;
+    // LW
+    case 0b010: val = read<F, uint32_t>(mem, proc, src); break;
+    // LB, with sign extension
+    case 0b000:
+      val = static_cast<uint32_t>(sign_extend<int32_t, sizeof(uint8_t)*8>(read<F, uint8_t>(mem, proc, src)));
+      break;
+    // LH, with sign extension
+    case 0b001:
+      val = static_cast<uint32_t>(sign_extend<int32_t, sizeof(uint16_t)*8>(read<F, uint16_t>(mem, proc, src)));
+      break;
+    // LBU
+    case 0b100: val = read<F, uint8_t>(mem, proc, src); break;
+    // LHU
+    case 0b101: val = read<F, uint16_t>(mem, proc, src); break;
+    default: return proc.next_pc();
   }
+  proc.write_reg(ii.rd(), val);
+
   // return next instruction
   return proc.next_pc();
 }
 
-// SB
-template<>
-void instrs::execute_store<0b000>(mem::memory& mem, processor& proc,
-    mem::address_t addr, uint8_t rs2)
-{
-  mem.write<uint8_t>(addr, static_cast<uint8_t>(proc.read_reg(rs2)));
-}
-
-// SH
-template<>
-void instrs::execute_store<0b001>(mem::memory& mem, processor& proc,
-    mem::address_t addr, uint8_t rs2)
-{
-  mem.write<uint16_t>(addr, static_cast<uint16_t>(proc.read_reg(rs2)));
-}
-
-// SW
-template<>
-void instrs::execute_store<0b010>(mem::memory& mem, processor& proc,
-    mem::address_t addr, uint8_t rs2)
-{
-  mem.write<uint32_t>(addr, proc.read_reg(rs2));
-}
-
+template<features F>
 uint32_t instrs::store(memory& mem, processor & proc, uint32_t bitstream) {
 
   s_instruction si{bitstream};
@@ -107,16 +114,34 @@ uint32_t instrs::store(memory& mem, processor & proc, uint32_t bitstream) {
   // compute dst address
   address_t src = proc.read_reg(si.rs1()) + si.imm();
 
-  // ToDo refactor with templates
+  uint32_t val = proc.read_reg(si.rs2());
   switch(si.funct3()) {
-    case 0b000: execute_store<0b000>(mem, proc, src, si.rs2()); break; // SB
-    case 0b001: execute_store<0b001>(mem, proc, src, si.rs2()); break; // SH
-    case 0b010: execute_store<0b010>(mem, proc, src, si.rs2()); break; // SW
+    case 0b000: write<F>(mem, proc, src, static_cast<uint8_t>(val)); break; // SB
+    case 0b001: write<F>(mem, proc, src, static_cast<uint16_t>(val)); break; // SH
+    case 0b010: write<F>(mem, proc, src, val); break; // SW
   }
   // return next instruction
   return proc.next_pc();
 }
 
+// the handlers of every configuration, for the engine selector
+template uint32_t instrs::load<configuration(0)>(memory&, processor&, uint32_t);
+template uint32_t instrs::load<configuration(1)>(memory&, processor&, uint32_t);
+template uint32_t instrs::load<configuration(2)>(memory&, processor&, uint32_t);
+template uint32_t instrs::load<configuration(3)>(memory&, processor&, uint32_t);
+template uint32_t instrs::load<configuration(4)>(memory&, processor&, uint32_t);
+template uint32_t instrs::load<configuration(5)>(memory&, processor&, uint32_t);
+template uint32_t instrs::load<configuration(6)>(memory&, processor&, uint32_t);
+template uint32_t instrs::load<configuration(7)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(0)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(1)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(2)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(3)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(4)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(5)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(6)>(memory&, processor&, uint32_t);
+template uint32_t instrs::store<configuration(7)>(memory&, processor&, uint32_t);
+
 // alu and immediate
 uint32_t instrs::alui(memory&, processor & proc, uint32_t bitstream) {
   i_instruction ii{bitstream};
@@ -172,13 +197,24 @@ uint32_t instrs::jal(memory&, processor& proc, uint32_t bitstream) {
   j_instruction ii{bitstream};
 
   uint32_t pc_ = proc.read_pc();
-  proc.write_reg(1, pc_ + 4);
+  proc.write_reg(ii.rd(), pc_ + 4);
 
   address_t src = pc_ + ii.imm();
 
   return src;
 }
 
+// jump and link register
+uint32_t instrs::jalr(memory&, processor& proc, uint32_t bitstream) {
+  i_instruction ii{bitstream};
+
+  // compute the target before the link as rd may be equal to rs1
+  address_t dst = (proc.read_reg(ii.rs1()) + ii.imm()) & ~static_cast<address_t>(1);
+  proc.write_reg(ii.rd(), proc.read_pc() + 4);
+
+  return dst;
+}
+
 // TODO condbranch
 uint32_t instrs::condbranch(memory&, processor& proc, uint32_t bitstream) {
   b_instruction bi(bitstream);
@@ -212,4 +248,41 @@ uint32_t instrs::condbranch(memory&, processor& proc, uint32_t bitstream) {
   // Si se cumple la condición, se suma el offset (imm) al siguiente PC
   address_t addr = take_branch ? (current_pc + bi.imm()) : proc.next_pc();
   return addr;
-}
\ No newline at end of file
+}
+// ecall, wfi and csrrs rd, csr, x0 on the user counters
+uint32_t instrs::system(memory& mem, processor& proc, uint32_t bitstream) {
+  i_instruction ii{bitstream};
+
+  if (bitstream == 0x00000073) {
+    return sys::emulator::current().ecall(mem, proc);
+  }
+
+  // wfi: there are no interrupts to wait for, halt like a while(1)
+  if (bitstream == 0x10500073) {
+    return proc.read_pc();
+  }
+
+  uint32_t csr = ii.imm() & 0xFFF;
+  uint32_t counter = csr & 0x7F;
+  bool high = (csr & ~0x7Fu) == 0xC80; // cycleh, timeh and instreth
+
+  if (ii.funct3() != 0b010 || ii.rs1() != 0 || counter > 2
+      || (!high && (csr & ~0x7Fu) != 0xC00)) {
+    std::cerr << "Unsupported system instruction 0x" << std::hex << bitstream
+              << " at pc 0x" << proc.read_pc() << std::dec << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  replay::environment& env = replay::environment::current();
+  uint64_t val;
+  switch (counter) {
+    // cycle and time both count host nanoseconds, recorded for replays
+    case 0: val = env.value(replay::input::cycle, [&env] { return env.host_clock(); }); break;
+    case 1: val = env.value(replay::input::time, [&env] { return env.host_clock(); }); break;
+    // instructions retired before this one, deterministic
+    default: val = env.retired(); break;
+  }
+  proc.write_reg(ii.rd(), static_cast<uint32_t>(high ? val >> 32 : val));
+
+  return proc.next_pc();
+}
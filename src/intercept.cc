@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include <intercept.hh>
+
+using namespace intercept;
+using namespace mem;
+
+namespace {
+
+constexpr std::array<const char*, routines> names{"memcpy", "memset", "strlen", "strcmp"};
+
+// rough cost of the newlib C routines on RV32I: fixed instructions per call
+// plus instructions per byte of their word loops
+struct cost {
+    uint64_t _call;
+    uint64_t _per_8_bytes;
+};
+
+constexpr std::array<cost, routines> costs{{
+    {12, 6},  // memcpy: lw, sw and the pointer updates per word
+    {10, 4},  // memset: sw and the pointer update per word
+    {8, 12},  // strlen: the word at a time zero test
+    {10, 18}, // strcmp: both words and the zero test
+}};
+
+[[noreturn]] void out_of_bounds(routine r, address_t addr)
+{
+    std::cerr << "Invalid guest address 0x" << std::hex << addr << std::dec << " in "
+              << routine_name(r) << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+// host pointer to a NUL terminated guest string, and its length
+const char* guest_string(routine r, const memory& mem, address_t addr, size_t& len)
+{
+    auto seg = mem.find_segment(addr);
+    if (seg == -1) {
+        out_of_bounds(r, addr);
+    }
+    const segment& s = mem.segments()[seg];
+    size_t avail = s.size() - (addr - s._initial_address);
+    const char* str = reinterpret_cast<const char*>(s.data() + (addr - s._initial_address));
+    const void* end = std::memchr(str, 0, avail);
+    if (end == nullptr) {
+        out_of_bounds(r, addr + static_cast<address_t>(avail));
+    }
+    len = static_cast<size_t>(static_cast<const char*>(end) - str);
+    return str;
+}
+
+uint8_t* guest_buffer(routine r, memory& mem, address_t addr, size_t len)
+{
+    uint8_t* p = mem.host_ptr(addr, len);
+    if (p == nullptr) {
+        out_of_bounds(r, addr);
+    }
+    return p;
+}
+
+// bytes r goes through with the arguments in proc, and the result of the
+// string routines
+size_t extent(routine r, const memory& mem, const processor& proc, uint32_t& val)
+{
+    address_t a0 = proc.read_reg(10), a1 = proc.read_reg(11);
+    switch (r) {
+        case routine::memcpy:
+        case routine::memset:
+            return proc.read_reg(12);
+        case routine::strlen: {
+            size_t len;
+            guest_string(r, mem, a0, len);
+            val = static_cast<uint32_t>(len);
+            return len;
+        }
+        case routine::strcmp: {
+            size_t la, lb;
+            auto sa = reinterpret_cast<const uint8_t*>(guest_string(r, mem, a0, la));
+            auto sb = reinterpret_cast<const uint8_t*>(guest_string(r, mem, a1, lb));
+            // the terminator of the shorter one ends the comparison
+            size_t len = std::min(la, lb) + 1;
+            auto diff = std::mismatch(sa, sa + len, sb);
+            val = diff.first == sa + len ? 0 : static_cast<uint32_t>(int32_t(*diff.first) - int32_t(*diff.second));
+            return static_cast<size_t>(diff.first - sa);
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+const char* intercept::routine_name(routine r)
+{
+    return names[static_cast<size_t>(r)];
+}
+
+accounting intercept::parse(const std::string& spec)
+{
+    if (spec.empty() || spec == "real") {
+        return accounting::real;
+    }
+    if (spec == "estimate") {
+        return accounting::estimate;
+    }
+    std::cerr << "Unknown instruction accounting: " << spec << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+table::table(const memory& mem, accounting a) :
+    _entries(), _filter(), _accounting(a), _calls(), _bytes(), _retired()
+{
+    for (size_t r = 0; r < routines; ++r) {
+        if (const symbol* sym = mem.find_symbol(names[r])) {
+            _entries[sym->_address] = static_cast<routine>(r);
+            _filter.set((sym->_address >> 2) % filter_size);
+        }
+    }
+}
+
+uint64_t table::retires(routine r, size_t bytes) const
+{
+    size_t i = static_cast<size_t>(r);
+    return _accounting == accounting::real ? 1 : costs[i]._call + (bytes * costs[i]._per_8_bytes + 7) / 8;
+}
+
+uint64_t table::cost(routine r, const memory& mem, const processor& proc) const
+{
+    uint32_t val;
+    return _accounting == accounting::real ? 1 : retires(r, extent(r, mem, proc, val));
+}
+
+uint64_t table::call(routine r, memory& mem, processor& proc)
+{
+    address_t a0 = proc.read_reg(10), a1 = proc.read_reg(11);
+    uint32_t val = 0;
+    size_t bytes = extent(r, mem, proc, val);
+
+    switch (r) {
+        case routine::memcpy:
+            if (bytes > 0) {
+                // memmove: memcpy of overlapping buffers is undefined in the
+                // guest too, this only keeps the host copy defined
+                std::memmove(guest_buffer(r, mem, a0, bytes), guest_buffer(r, mem, a1, bytes), bytes);
+                mem.mark_dirty(a0, bytes);
+            }
+            break;
+        case routine::memset:
+            if (bytes > 0) {
+                std::memset(guest_buffer(r, mem, a0, bytes), static_cast<uint8_t>(a1), bytes);
+                mem.mark_dirty(a0, bytes);
+            }
+            break;
+        case routine::strlen:
+        case routine::strcmp:
+            proc.write_reg(10, val);
+            break;
+    }
+
+    size_t i = static_cast<size_t>(r);
+    uint64_t retired = retires(r, bytes);
+    _calls[i]++;
+    _bytes[i] += bytes;
+    _retired[i] += retired;
+
+    proc.write_pc(proc.read_reg(1));
+    return retired;
+}
+
+void table::report(std::ostream& os) const
+{
+    if (empty()) {
+        os << "Native routines: none of memcpy, memset, strlen and strcmp in the symbols, nothing intercepted"
+           << std::endl;
+        return;
+    }
+    os << "Native routines (" << (_accounting == accounting::real ? "one instruction per call"
+                : "estimated instructions") << ")" << std::endl
+       << "routine        calls          bytes   instructions" << std::endl;
+    for (size_t r = 0; r < routines; ++r) {
+        if (_calls[r] == 0) {
+            continue;
+        }
+        os << std::left << std::setw(8) << names[r] << std::right << std::setw(11) << _calls[r]
+           << std::setw(15) << _bytes[r] << std::setw(15) << _retired[r] << std::endl;
+    }
+}
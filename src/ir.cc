@@ -0,0 +1,671 @@
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <map>
+#include <numeric>
+#include <tuple>
+
+#include <instructions.hh>
+#include <ir.hh>
+
+using namespace ir;
+using namespace mem;
+
+namespace {
+
+constexpr uint32_t none = ~static_cast<uint32_t>(0);
+
+bool uses_a(op o)
+{
+    return o != op::constant && o != op::get && o != op::system && o != op::nop;
+}
+
+bool uses_b(op o)
+{
+    return o == op::add || o == op::sub || o == op::mul || o == op::store || o == op::guard;
+}
+
+// branch condition funct3 on x and y, the reserved ones never hold
+bool compare(uint8_t cond, uint32_t x, uint32_t y)
+{
+    switch (cond) {
+        case 0b000: return x == y;
+        case 0b001: return x != y;
+        case 0b100: return int32_t(x) < int32_t(y);
+        case 0b101: return int32_t(x) >= int32_t(y);
+        case 0b110: return x < y;
+        case 0b111: return x >= y;
+    }
+    return false;
+}
+
+uint32_t extend(uint32_t val, uint8_t size, bool is_signed)
+{
+    switch (size) {
+        case 1: return is_signed ? uint32_t(int32_t(int8_t(val))) : (val & 0xFF);
+        case 2: return is_signed ? uint32_t(int32_t(int16_t(val))) : (val & 0xFFFF);
+    }
+    return val;
+}
+
+// Values replaced by a pass. Operands always name earlier nodes, so a single
+// forward walk rewrites every use once its definition was visited.
+class renaming {
+  private:
+    std::vector<uint32_t> _to;
+
+  public:
+    explicit renaming(size_t n) : _to(n) { std::iota(_to.begin(), _to.end(), 0); }
+
+    void replace(block& b, uint32_t i, uint32_t by)
+    {
+        _to[i] = by;
+        b._nodes[i]._op = op::nop;
+    }
+
+    void operands(node& n) const
+    {
+        if (uses_a(n._op)) {
+            n._a = _to[n._a];
+        }
+        if (uses_b(n._op)) {
+            n._b = _to[n._b];
+        }
+    }
+
+    void ending(block& b) const
+    {
+        if (b._ending == ending::indirect || b._ending == ending::branch) {
+            b._a = _to[b._a];
+        }
+        if (b._ending == ending::branch) {
+            b._b = _to[b._b];
+        }
+    }
+};
+
+class builder {
+  private:
+    block& _b;
+    std::array<uint32_t, 32> _regs; // value held by each register, or none
+
+  public:
+    explicit builder(block& b) : _b(b) { _regs.fill(none); }
+
+    uint32_t emit(const node& n)
+    {
+        _b._nodes.push_back(n);
+        return static_cast<uint32_t>(_b._nodes.size() - 1);
+    }
+
+    uint32_t constant(uint32_t imm) { return emit(node{._op = op::constant, ._imm = imm}); }
+
+    uint32_t binary(op o, uint32_t a, uint32_t b) { return emit(node{._op = o, ._a = a, ._b = b}); }
+
+    uint32_t immediate(op o, uint32_t a, uint32_t imm) { return emit(node{._op = o, ._a = a, ._imm = imm}); }
+
+    uint32_t read(uint8_t r)
+    {
+        if (r == 0) {
+            return constant(0);
+        }
+        if (_regs[r] == none) {
+            _regs[r] = emit(node{._op = op::get, ._reg = r});
+        }
+        return _regs[r];
+    }
+
+    void write(uint8_t r, uint32_t val)
+    {
+        if (r != 0) {
+            emit(node{._op = op::set, ._reg = r, ._a = val});
+            _regs[r] = val;
+        }
+    }
+
+    // the system instruction may read and write any register
+    void system(uint32_t bitstream, address_t pc, uint32_t index)
+    {
+        emit(node{._op = op::system, ._imm = bitstream, ._pc = pc, ._index = index});
+        _regs.fill(none);
+    }
+};
+
+// Lowers the instruction at pc, the i-th of b. The transfer ending an inner
+// step of a trace does not end b: it continues at follow and leaves b
+// through a guard when it would go elsewhere.
+bool lower_instruction(builder& ir, block& b, uint32_t bitstream, address_t at, uint32_t i,
+        bool inner, address_t follow)
+{
+    instrs::i_instruction ii{bitstream};
+    instrs::r_instruction ri{bitstream};
+
+    // the same operations, quirks included, as the routines in instructions.cc
+    switch (bitstream & 0x7F) {
+    case 0b0010011: { // alui
+        uint32_t val = ir.read(ii.rs1());
+        switch (ii.funct3()) {
+            case 0b000: val = ir.immediate(op::addi, val, ii.imm()); break;
+            case 0b001: val = ir.immediate(op::shli, val, ii.imm() & 0x1F); break;
+            case 0b010: val = ir.immediate(op::addi, val, 0 - ii.imm()); break;
+        }
+        ir.write(ii.rd(), val);
+        break;
+    }
+    case 0b0110011: { // alur
+        uint32_t a = ir.read(ri.rs1());
+        uint32_t c = ir.read(ri.rs2());
+        uint32_t val;
+        if (ri.funct3() == 0b000 && ri.funct7() == 0b0000000) {
+            val = ir.binary(op::add, a, c);
+        } else if (ri.funct3() == 0b000 && ri.funct7() == 0b0000001) {
+            val = ir.binary(op::mul, a, c);
+        } else if (ri.funct3() == 0b010) {
+            val = ir.binary(op::sub, a, c);
+        } else {
+            val = ir.constant(0);
+        }
+        ir.write(ri.rd(), val);
+        break;
+    }
+    case 0b0110111: { // lui
+        instrs::u_instruction ui{bitstream};
+        ir.write(ui.rd(), ir.constant(ui.imm()));
+        break;
+    }
+    case 0b0000011: { // load
+        uint8_t size = 0;
+        bool is_signed = false;
+        switch (ii.funct3()) {
+            case 0b010: size = 4; break;
+            case 0b100: size = 1; break;
+            case 0b000: size = 1; is_signed = true; break;
+            case 0b001: size = 2; is_signed = true; break;
+            case 0b101: size = 2; break;
+        }
+        if (size != 0) {
+            uint32_t addr = ir.immediate(op::addi, ir.read(ii.rs1()), ii.imm());
+            ir.write(ii.rd(), ir.emit(node{._op = op::load, ._size = size,
+                            ._signed = is_signed, ._a = addr, ._pc = at, ._index = i}));
+        }
+        break;
+    }
+    case 0b0100011: { // store
+        instrs::s_instruction si{bitstream};
+        uint8_t size = 0;
+        switch (si.funct3()) {
+            case 0b000: size = 1; break;
+            case 0b001: size = 2; break;
+            case 0b010: size = 4; break;
+        }
+        if (size != 0) {
+            uint32_t addr = ir.immediate(op::addi, ir.read(si.rs1()), static_cast<uint32_t>(si.imm()));
+            ir.emit(node{._op = op::store, ._size = size, ._a = addr, ._b = ir.read(si.rs2()),
+                        ._pc = at, ._index = i});
+        }
+        break;
+    }
+    case 0b1110011: // system
+        ir.system(bitstream, at, i);
+        break;
+    case 0b1101111: { // jal
+        instrs::j_instruction ji{bitstream};
+        ir.write(ji.rd(), ir.constant(at + 4));
+        if (inner) {
+            return follow == at + ji.imm();
+        }
+        b._ending = ending::jump;
+        b._target = at + ji.imm();
+        break;
+    }
+    case 0b1100111: { // jalr, the target before the link as rd may be rs1
+        if (inner) {
+            return false;
+        }
+        b._a = ir.immediate(op::addi, ir.read(ii.rs1()), ii.imm());
+        ir.write(ii.rd(), ir.constant(at + 4));
+        b._ending = ending::indirect;
+        break;
+    }
+    case 0b1100011: { // branch
+        instrs::b_instruction bi{bitstream};
+        uint32_t x = ir.read(bi.rs1());
+        uint32_t y = ir.read(bi.rs2());
+        address_t target = at + bi.imm();
+        if (inner) {
+            if (follow != target && follow != at + 4) {
+                return false;
+            }
+            // leave when the branch goes the other way: the inverse of a
+            // condition flips the low bit of funct3
+            bool taken = follow == target;
+            if (target != at + 4) {
+                ir.emit(node{._op = op::guard, ._cond = static_cast<uint8_t>(taken ? bi.funct3() ^ 1 : bi.funct3()),
+                            ._a = x, ._b = y, ._imm = taken ? at + 4 : target, ._pc = at, ._index = i});
+            }
+            break;
+        }
+        b._a = x;
+        b._b = y;
+        b._cond = bi.funct3();
+        b._ending = ending::branch;
+        b._target = target;
+        break;
+    }
+    default:
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+std::unique_ptr<block> ir::lower(const std::vector<uint32_t>& bitstreams, address_t pc)
+{
+    return lower_trace({step{pc, bitstreams}});
+}
+
+std::unique_ptr<block> ir::lower_trace(const std::vector<step>& steps)
+{
+    auto b = std::make_unique<block>();
+    b->_pc = steps.front()._pc;
+    b->_length = 0;
+    builder ir(*b);
+
+    for (size_t s = 0; s < steps.size(); ++s) {
+        // the last instruction of an inner step continues the trace at the
+        // next one, its other way out becomes a side exit
+        bool inner = s + 1 < steps.size();
+        address_t follow = inner ? steps[s + 1]._pc : 0;
+        const std::vector<uint32_t>& bitstreams = steps[s]._bitstreams;
+
+        for (size_t j = 0; j < bitstreams.size(); ++j) {
+            uint32_t bitstream = bitstreams[j];
+            uint32_t i = b->_length++;
+            address_t at = steps[s]._pc + 4 * static_cast<address_t>(j);
+            bool last = j + 1 == bitstreams.size();
+            b->_last = at;
+            b->_next = at + 4;
+            if (!lower_instruction(ir, *b, bitstream, at, i, inner && last, follow)) {
+                return nullptr;
+            }
+
+            // only the last instruction may leave the block
+            if (b->_ending != ending::next && !(last && !inner)) {
+                return nullptr;
+            }
+        }
+        if (inner && (bitstreams.back() & 0x73) != 0b1100011 && follow != b->_next) {
+            return nullptr;
+        }
+    }
+    b->_values.resize(b->_nodes.size());
+    return b;
+}
+
+void ir::fold_constants(block& b)
+{
+    renaming names(b._nodes.size());
+    auto is_const = [&b](uint32_t v) { return b._nodes[v]._op == op::constant; };
+    auto value = [&b](uint32_t v) { return b._nodes[v]._imm; };
+    auto make_const = [](node& n, uint32_t imm) {
+        n = node{._op = op::constant, ._imm = imm};
+    };
+
+    for (uint32_t i = 0; i < b._nodes.size(); ++i) {
+        node& n = b._nodes[i];
+        names.operands(n);
+        switch (n._op) {
+        case op::addi:
+        case op::shli:
+            if (n._imm == 0) {
+                names.replace(b, i, n._a);
+            } else if (is_const(n._a)) {
+                make_const(n, n._op == op::addi ? value(n._a) + n._imm : value(n._a) << n._imm);
+            }
+            break;
+        case op::add:
+        case op::sub:
+        case op::mul:
+            if (is_const(n._a) && is_const(n._b)) {
+                uint32_t x = value(n._a), y = value(n._b);
+                make_const(n, n._op == op::add ? x + y : n._op == op::sub ? x - y : x * y);
+            } else if (n._op != op::mul && is_const(n._b)) {
+                // x + c and x - c take the immediate form
+                uint32_t c = value(n._b);
+                n = node{._op = op::addi, ._a = n._a, ._imm = n._op == op::add ? c : 0 - c};
+                if (n._imm == 0) {
+                    names.replace(b, i, n._a);
+                }
+            } else if (n._op == op::add && is_const(n._a)) {
+                n = node{._op = op::addi, ._a = n._b, ._imm = value(n._a)};
+                if (n._imm == 0) {
+                    names.replace(b, i, n._a);
+                }
+            } else if (n._op == op::mul && (is_const(n._a) || is_const(n._b))) {
+                uint32_t c = is_const(n._a) ? value(n._a) : value(n._b);
+                uint32_t x = is_const(n._a) ? n._b : n._a;
+                if (c == 0) {
+                    make_const(n, 0);
+                } else if (c == 1) {
+                    names.replace(b, i, x);
+                }
+            }
+            break;
+        case op::guard:
+            // a guard that can never exit
+            if (is_const(n._a) && is_const(n._b) && !compare(n._cond, value(n._a), value(n._b))) {
+                n._op = op::nop;
+            }
+            break;
+        case op::extend:
+            if (is_const(n._a)) {
+                make_const(n, extend(value(n._a), n._size, n._signed));
+            } else if (n._size == 4) {
+                names.replace(b, i, n._a);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    names.ending(b);
+}
+
+void ir::eliminate_common(block& b)
+{
+    renaming names(b._nodes.size());
+    std::map<std::tuple<op, uint32_t, uint32_t, uint32_t, uint8_t, bool>, uint32_t> seen;
+
+    for (uint32_t i = 0; i < b._nodes.size(); ++i) {
+        node& n = b._nodes[i];
+        names.operands(n);
+
+        // (x + c1) + c2 is x + (c1 + c2): the offsets from one base register
+        // share the base, which the memory forwarding compares
+        if (n._op == op::addi && b._nodes[n._a]._op == op::addi) {
+            n._imm += b._nodes[n._a]._imm;
+            n._a = b._nodes[n._a]._a;
+        }
+
+        switch (n._op) {
+        case op::constant:
+        case op::addi:
+        case op::shli:
+        case op::add:
+        case op::sub:
+        case op::mul:
+        case op::extend: {
+            uint32_t a = n._a, c = n._b;
+            if ((n._op == op::add || n._op == op::mul) && a > c) {
+                std::swap(a, c);
+            }
+            auto key = std::make_tuple(n._op, uses_a(n._op) ? a : 0, uses_b(n._op) ? c : 0,
+                    n._imm, n._size, n._signed);
+            auto [it, fresh] = seen.emplace(key, i);
+            if (!fresh) {
+                names.replace(b, i, it->second);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    names.ending(b);
+}
+
+void ir::forward_memory(block& b)
+{
+    // bytes known to be in memory: the low _size bytes of _value are at
+    // _base + _offset, already extended for loads
+    struct known {
+        uint32_t _base;
+        uint32_t _offset;
+        uint8_t _size;
+        uint32_t _value;
+        bool _extended;
+        bool _signed;
+    };
+    std::vector<known> bytes;
+    renaming names(b._nodes.size());
+
+    auto address = [&b](uint32_t v) {
+        const node& n = b._nodes[v];
+        if (n._op == op::addi) {
+            return std::make_pair(n._a, n._imm);
+        }
+        if (n._op == op::constant) {
+            return std::make_pair(none, n._imm);
+        }
+        return std::make_pair(v, 0u);
+    };
+
+    for (uint32_t i = 0; i < b._nodes.size(); ++i) {
+        node& n = b._nodes[i];
+        names.operands(n);
+
+        if (n._op == op::system) {
+            bytes.clear();
+        } else if (n._op == op::load) {
+            auto [base, offset] = address(n._a);
+            auto it = std::find_if(bytes.begin(), bytes.end(), [&](const known& k) {
+                return k._base == base && k._offset == offset && k._size == n._size;
+            });
+            if (it == bytes.end()) {
+                bytes.push_back(known{base, offset, n._size, i, true, n._signed});
+            } else if (n._size == 4 || (it->_extended && it->_signed == n._signed)) {
+                names.replace(b, i, it->_value);
+            } else {
+                n = node{._op = op::extend, ._size = n._size, ._signed = n._signed, ._a = it->_value};
+            }
+        } else if (n._op == op::store) {
+            auto [base, offset] = address(n._a);
+            // another base may hold the same address
+            std::erase_if(bytes, [&](const known& k) {
+                int32_t d = static_cast<int32_t>(k._offset - offset);
+                return k._base != base || (d < n._size && -d < k._size);
+            });
+            bytes.push_back(known{base, offset, n._size, n._b, false, false});
+        }
+    }
+    names.ending(b);
+}
+
+void ir::eliminate_writebacks(block& b)
+{
+    // registers set again later, with no node that may leave the block between
+    std::bitset<32> overwritten;
+    for (size_t i = b._nodes.size(); i-- > 0;) {
+        node& n = b._nodes[i];
+        if (n._op == op::system || n._op == op::guard || n._op == op::load || n._op == op::store) {
+            overwritten.reset();
+        } else if (n._op == op::set) {
+            if (overwritten[n._reg]) {
+                n._op = op::nop;
+            }
+            overwritten.set(n._reg);
+        }
+    }
+}
+
+void ir::eliminate_dead(block& b)
+{
+    std::vector<bool> live(b._nodes.size(), false);
+    if (b._ending == ending::indirect || b._ending == ending::branch) {
+        live[b._a] = true;
+    }
+    if (b._ending == ending::branch) {
+        live[b._b] = true;
+    }
+    for (size_t i = b._nodes.size(); i-- > 0;) {
+        node& n = b._nodes[i];
+        // loads stay for their alignment check
+        if (n._op == op::set || n._op == op::load || n._op == op::store || n._op == op::system
+                || n._op == op::guard) {
+            live[i] = true;
+        }
+        if (!live[i] || n._op == op::nop) {
+            continue;
+        }
+        if (uses_a(n._op)) {
+            live[n._a] = true;
+        }
+        if (uses_b(n._op)) {
+            live[n._b] = true;
+        }
+    }
+
+    std::vector<uint32_t> to(b._nodes.size(), none);
+    std::vector<node> kept;
+    for (uint32_t i = 0; i < b._nodes.size(); ++i) {
+        node n = b._nodes[i];
+        if (!live[i] || n._op == op::nop) {
+            continue;
+        }
+        if (uses_a(n._op)) {
+            n._a = to[n._a];
+        }
+        if (uses_b(n._op)) {
+            n._b = to[n._b];
+        }
+        to[i] = static_cast<uint32_t>(kept.size());
+        kept.push_back(n);
+    }
+    if (b._ending == ending::indirect || b._ending == ending::branch) {
+        b._a = to[b._a];
+    }
+    if (b._ending == ending::branch) {
+        b._b = to[b._b];
+    }
+    b._nodes = std::move(kept);
+    b._values.resize(b._nodes.size());
+}
+
+void ir::optimise(block& b)
+{
+    fold_constants(b);
+    eliminate_common(b);
+    forward_memory(b);
+    // forwarded values may be extensions of constants
+    fold_constants(b);
+    eliminate_writebacks(b);
+    eliminate_dead(b);
+}
+
+bool ir::valid(const block& b)
+{
+    for (uint32_t i = 0; i < b._nodes.size(); ++i) {
+        const node& n = b._nodes[i];
+        if (n._op > op::nop || (uses_a(n._op) && n._a >= i) || (uses_b(n._op) && n._b >= i)) {
+            return false;
+        }
+        bool sized = n._op == op::extend || n._op == op::load || n._op == op::store;
+        if (sized && n._size != 1 && n._size != 2 && n._size != 4) {
+            return false;
+        }
+        if ((n._op == op::get || n._op == op::set) && n._reg >= 32) {
+            return false;
+        }
+        if (n._op == op::shli && n._imm >= 32) {
+            return false;
+        }
+    }
+    size_t count = b._nodes.size();
+    switch (b._ending) {
+    case ending::next:
+    case ending::jump:
+        return true;
+    case ending::indirect:
+        return b._a < count;
+    case ending::branch:
+        return b._a < count && b._b < count;
+    }
+    return false;
+}
+
+outcome ir::run(const block& b, memory& mem, processor& proc, uint64_t& retired)
+{
+    uint64_t start = retired;
+    uint32_t* v = b._values.data();
+
+    for (uint32_t i = 0; i < b._nodes.size(); ++i) {
+        const node& n = b._nodes[i];
+        switch (n._op) {
+        case op::constant: v[i] = n._imm; break;
+        case op::get: v[i] = proc.read_reg(n._reg); break;
+        case op::addi: v[i] = v[n._a] + n._imm; break;
+        case op::shli: v[i] = v[n._a] << n._imm; break;
+        case op::add: v[i] = v[n._a] + v[n._b]; break;
+        case op::sub: v[i] = v[n._a] - v[n._b]; break;
+        case op::mul: v[i] = v[n._a] * v[n._b]; break;
+        case op::extend: v[i] = extend(v[n._a], n._size, n._signed); break;
+        case op::load:
+            if ((v[n._a] & (n._size - 1)) != 0) {
+                retired = start + n._index;
+                return outcome{n._pc, false, true};
+            }
+            switch (n._size) {
+                case 1: v[i] = extend(mem.read<uint8_t>(v[n._a]), 1, n._signed); break;
+                case 2: v[i] = extend(mem.read<uint16_t>(v[n._a]), 2, n._signed); break;
+                default: v[i] = mem.read<uint32_t>(v[n._a]); break;
+            }
+            break;
+        case op::store:
+            if ((v[n._a] & (n._size - 1)) != 0) {
+                retired = start + n._index;
+                return outcome{n._pc, false, true};
+            }
+            switch (n._size) {
+                case 1: mem.write<uint8_t>(v[n._a], static_cast<uint8_t>(v[n._b])); break;
+                case 2: mem.write<uint16_t>(v[n._a], static_cast<uint16_t>(v[n._b])); break;
+                default: mem.write<uint32_t>(v[n._a], v[n._b]); break;
+            }
+            // the rest of the block may be what the store rewrote
+            if (mem.code_written()) {
+                retired = start + n._index + 1;
+                return outcome{n._pc + 4, false, false};
+            }
+            break;
+        case op::set: proc.write_reg(n._reg, v[n._a]); break;
+        case op::system:
+            // the counters see the instructions retired before this one
+            retired = start + n._index;
+            proc.write_pc(n._pc);
+            if (instrs::system(mem, proc, n._imm) == n._pc) {
+                retired += 1;
+                return outcome{n._pc, true, false};
+            }
+            // like read, which may land on code
+            if (mem.code_written()) {
+                retired = start + n._index + 1;
+                return outcome{n._pc + 4, false, false};
+            }
+            break;
+        case op::guard:
+            if (compare(n._cond, v[n._a], v[n._b])) {
+                retired = start + n._index + 1;
+                return outcome{n._imm, n._imm == n._pc, false};
+            }
+            break;
+        case op::nop: break;
+        }
+    }
+
+    retired = start + b._length;
+    switch (b._ending) {
+    case ending::jump:
+        return outcome{b._target, b._target == b._last, false};
+    case ending::indirect: {
+        address_t target = v[b._a] & ~static_cast<address_t>(1);
+        return outcome{target, target == b._last, false};
+    }
+    case ending::branch: {
+        bool taken = compare(b._cond, v[b._a], v[b._b]);
+        return outcome{taken ? b._target : b._next, taken && b._target == b._last, false};
+    }
+    case ending::next:
+        break;
+    }
+    return outcome{b._next, false, false};
+}
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include <lockstep.hh>
+
+using namespace lockstep;
+using namespace mem;
+
+namespace {
+
+constexpr uint64_t forever = ~static_cast<uint64_t>(0);
+
+inline uint64_t fnv(uint64_t hash, const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+template<typename T>
+uint64_t fnv(uint64_t hash, const T& val)
+{
+    return fnv(hash, reinterpret_cast<const uint8_t*>(&val), sizeof(T));
+}
+
+// pc, registers and the pages written since the dirty bits were cleared
+uint64_t digest(const memory& mem, const processor& proc)
+{
+    uint64_t hash = fnv(0xcbf29ce484222325, proc.read_pc());
+    for (size_t i = 1; i < 32; ++i) {
+        hash = fnv(hash, proc.read_reg(i));
+    }
+    mem.for_each_dirty([&mem, &hash](size_t s, size_t p) {
+        const segment& seg = mem.segments()[s];
+        size_t pos = p << page_bits;
+        hash = fnv(fnv(hash, seg._initial_address), p);
+        hash = fnv(hash, seg.data() + pos, std::min(page_size, seg.size() - pos));
+    });
+    return hash;
+}
+
+std::string hex(uint32_t v, int digits = 8)
+{
+    std::ostringstream os;
+    os << "0x" << std::hex << std::setfill('0') << std::setw(digits) << v;
+    return os.str();
+}
+
+// the fields printed one after the other
+template<typename... T>
+std::string label(const T&... fields)
+{
+    std::ostringstream os;
+    (os << ... << fields);
+    return os.str();
+}
+
+void line(std::ostream& os, const std::string& what, const std::string& ref, const std::string& fast)
+{
+    os << "  " << std::left << std::setw(16) << what << std::setw(12) << ref << fast
+       << std::right << std::endl;
+}
+
+} // namespace
+
+params lockstep::parse(const std::string& spec)
+{
+    if (spec == "instr") {
+        return params{granularity::instruction, 1};
+    }
+    if (spec == "block") {
+        return params{granularity::block, 0};
+    }
+    params p{granularity::interval, 0};
+    std::string count = spec;
+    if (spec.rfind("hash:", 0) == 0) {
+        p._when = granularity::digest;
+        count = spec.substr(5);
+    }
+    std::istringstream in(count);
+    char extra = 0;
+    if (!(in >> p._interval) || p._interval == 0 || (in >> extra)) {
+        std::cerr << "Invalid lockstep granularity: " << spec << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+checker::checker(const params& p, const memory& mem, const processor& proc, uint64_t retired,
+        const aot::module* translation, engine::compiler* background) :
+    _params(p), _retired(retired), _env(replay::mode::replay, _retired), _syscalls(_env),
+    _mem(mem), _proc(proc), _blocks(nullptr, translation), _boundary(true), _diverged(false),
+    _agreed(retired), _agreed_pc(proc.read_pc()), _report()
+{
+    _mem.detach_all();
+    _syscalls.set_echo(false);
+    _blocks.compile_on(background);
+    // the reference spins in them until the budget runs out
+    _blocks.halt_endless(false);
+}
+
+bool checker::compare(memory& mem, const processor& proc, const sys::emulator& syscalls,
+        const engine::result& ref, const engine::result& fast)
+{
+    bool same_status = ref._retired == fast._retired
+        && (ref._status == engine::status::halted) == (fast._status == engine::status::halted);
+    if (_params._when == granularity::digest && same_status
+            && digest(mem, proc) == digest(_mem, _proc)) {
+        mem.clear_dirty();
+        _mem.clear_dirty();
+        return true;
+    }
+
+    std::ostringstream diffs;
+    if (ref._retired != fast._retired) {
+        line(diffs, "retired", std::to_string(ref._retired), std::to_string(fast._retired));
+    }
+    if (!same_status) {
+        line(diffs, "halted", ref._status == engine::status::halted ? "yes" : "no",
+                fast._status == engine::status::halted ? "yes" : "no");
+    }
+    if (proc.read_pc() != _proc.read_pc()) {
+        line(diffs, "pc", hex(proc.read_pc()), hex(_proc.read_pc()));
+    }
+    for (size_t i = 1; i < 32; ++i) {
+        if (proc.read_reg(i) != _proc.read_reg(i)) {
+            line(diffs, label("x", i), hex(proc.read_reg(i)), hex(_proc.read_reg(i)));
+        }
+    }
+    if (syscalls.exited() != _syscalls.exited() || syscalls.status() != _syscalls.status()) {
+        auto exit = [](const sys::emulator& s) {
+            return s.exited() ? std::to_string(s.status()) : std::string("running");
+        };
+        line(diffs, "exit", exit(syscalls), exit(_syscalls));
+    }
+
+    // the pages either engine wrote, the first differing byte of each
+    const auto& ref_segs = mem.segments();
+    const auto& fast_segs = _mem.segments();
+    if (ref_segs.size() != fast_segs.size()) {
+        line(diffs, "segments", std::to_string(ref_segs.size()), std::to_string(fast_segs.size()));
+    } else {
+        size_t pages = 0;
+        for (size_t s = 0; s < ref_segs.size(); ++s) {
+            const segment& a = ref_segs[s];
+            const segment& b = fast_segs[s];
+            if (a._initial_address != b._initial_address || a.size() != b.size()) {
+                line(diffs, label("segment ", s), label(hex(a._initial_address), "+", a.size()),
+                        label(hex(b._initial_address), "+", b.size()));
+                continue;
+            }
+            for (size_t w = 0; w < a._dirty.size(); ++w) {
+                for (uint64_t word = a._dirty[w] | b._dirty[w]; word != 0; word &= word - 1) {
+                    size_t pos = (w * 64 + static_cast<size_t>(std::countr_zero(word))) << page_bits;
+                    size_t len = std::min(page_size, a.size() - pos);
+                    auto [x, y] = std::mismatch(a.data() + pos, a.data() + pos + len, b.data() + pos);
+                    if (x == a.data() + pos + len) {
+                        continue;
+                    }
+                    if (pages++ == 0) {
+                        address_t addr = a._initial_address + static_cast<address_t>(x - a.data());
+                        line(diffs, label("mem ", hex(addr)), hex(*x, 2), hex(*y, 2));
+                    }
+                }
+            }
+        }
+        if (pages > 1) {
+            line(diffs, "pages differing", std::to_string(pages), "");
+        }
+    }
+
+    if (diffs.str().empty() && _params._when == granularity::digest) {
+        // same contents, but not the same pages written
+        line(diffs, "dirty pages", std::to_string(mem.dirty_pages()), std::to_string(_mem.dirty_pages()));
+    }
+    mem.clear_dirty();
+    _mem.clear_dirty();
+    if (diffs.str().empty()) {
+        return true;
+    }
+    _report << diffs.str();
+    return false;
+}
+
+engine::result checker::run(memory& mem, processor& proc, const engine::models& m,
+        uint64_t& retired, uint64_t max)
+{
+    replay::environment& env = replay::environment::current();
+    sys::emulator& syscalls = sys::emulator::current();
+    if (env.get_mode() == replay::mode::live) {
+        std::cerr << "Lockstep execution needs the host inputs recorded or replayed" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    _blocks.configure(m._features);
+    engine::models ref = m;
+    uint64_t step = forever;
+    if (_params._when == granularity::block) {
+        ref._stop = &_boundary;
+    } else {
+        step = _params._interval;
+    }
+
+    // the clone holds the same contents
+    mem.clear_dirty();
+    _mem.clear_dirty();
+
+    uint64_t start = retired;
+    while (retired - start < max) {
+        replay::environment::cursor from = env.position();
+        engine::result a = engine::run_reference(mem, proc, ref, retired,
+                std::min(step, max - (retired - start)));
+
+        // the block engine takes the inputs the reference just took
+        _env.replay_log(env.slice(from, env.position()), from._last);
+        _env.make_current();
+        _syscalls.make_current();
+        engine::result b = _blocks.run(_mem, _proc, _retired, a._retired);
+        env.make_current();
+        syscalls.make_current();
+
+        if (!compare(mem, proc, syscalls, a, b)) {
+            std::ostringstream head;
+            head << "Lockstep divergence after " << retired << " instructions" << std::endl
+                 << "  agreed after " << _agreed << " instructions, at pc " << hex(_agreed_pc)
+                 << std::endl;
+            line(head, "", "reference", "blocks");
+            _report.str(head.str() + _report.str());
+            _diverged = true;
+            return engine::result{engine::status::halted, retired - start, proc.read_pc()};
+        }
+        _agreed = retired;
+        _agreed_pc = proc.read_pc();
+
+        if (a._status == engine::status::halted) {
+            return engine::result{engine::status::halted, retired - start, a._pc};
+        }
+        if (m._stop && m._stop->load(std::memory_order_relaxed)) {
+            return engine::result{engine::status::deadline, retired - start, proc.read_pc()};
+        }
+    }
+    return engine::result{engine::status::limit, retired - start, proc.read_pc()};
+}
+
+void checker::report(std::ostream& os) const
+{
+    os << _report.str();
+}
@@ -1,36 +1,286 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
 
+#include <analysis.hh>
+#include <aot.hh>
+#include <bpred.hh>
+#include <cache.hh>
+#include <callstack.hh>
+#include <codecache.hh>
+#include <compiler.hh>
+#include <engine.hh>
 #include <instructions.hh>
+#include <intercept.hh>
+#include <lockstep.hh>
 #include <memory.hh>
+#include <parallel.hh>
 #include <processor.hh>
+#include <replay.hh>
+#include <sampler.hh>
+#include <sampling.hh>
+#include <stackdist.hh>
+#include <syscalls.hh>
+#include <timeline.hh>
+#include <timing.hh>
 
 using namespace instrs;
 using namespace mem;
 
+static void usage()
+{
+    std::cerr << "Invalid Syntax: peRISCVcope [options] <program>" << std::endl
+              << "  --fast                  run the predecoded block engine, with only the" << std::endl
+              << "                          --cache, --miss-curves and --host-profile models" << std::endl
+              << "  --aot=<object>          with --fast or --lockstep, run the blocks translated" << std::endl
+              << "                          by periscvcope-aot" << std::endl
+              << "  --code-cache=<dir>      with --fast, keep the decoded and optimised blocks" << std::endl
+              << "                          in dir for the next runs of the same program" << std::endl
+              << "  --compile-threads=<n>   with --fast or --lockstep, optimise blocks on" << std::endl
+              << "                          n threads (0: inline, default: one less than the cores)" << std::endl
+              << "  --lockstep[=<when>]     check the block engine against the reference loop," << std::endl
+              << "                          comparing at every instr, block (default), N" << std::endl
+              << "                          instructions, or hash:N for digests every N" << std::endl
+              << "  --isa=<rv32i|rv32im>    instruction set, mul is illegal in rv32i (default rv32im)" << std::endl
+              << "  --no-align-checks       do not stop on misaligned loads and stores" << std::endl
+              << "  --sample=<N:W:M>        fast-forward N, warm W and measure M instructions" << std::endl
+              << "                          with --timing and --cache models, repeatedly" << std::endl
+              << "  --intercept[=<count>]   run memcpy, memset, strlen and strcmp natively, each" << std::endl
+              << "                          call retiring one instruction (real) or an estimate" << std::endl
+              << "  --max-instrs=<n>        stop after n instructions, exit status 124" << std::endl
+              << "  --deadline=<seconds>    stop after a wall-clock time, exit status 124" << std::endl
+              << "  --record=<file>         log the inputs from the host to replay the run;" << std::endl
+              << "                          files mapped with mmap are logged whole" << std::endl
+              << "  --replay=<file>         run again with the inputs of a recorded log" << std::endl
+              << "  --seek=<n>              show the state after n instructions, with checkpoints" << std::endl
+              << "                          every 2^20 instructions to get there" << std::endl
+              << "  --parallel=<K[:W]>      simulate intervals of K instructions (warmed by W)" << std::endl
+              << "                          on all cores with --timing and --cache models" << std::endl
+              << "  --folded=<file>         write folded call stacks for flamegraph.pl" << std::endl
+              << "  --host-profile[=<hz>]   sample host CPU time per guest pc (default 1000 Hz)" << std::endl
+              << "  --trace=<file>          write a binary execution trace" << std::endl
+              << "  --miss-curves[=<line>]  miss ratios of all LRU caches in one pass (64-byte lines)" << std::endl
+              << "  --bpred[=<list>]        compare branch predictors (static,bimodal,gshare,tage)" << std::endl
+              << "  --timing[=<params>]     5-stage pipeline CPI, e.g. mul=3,branch=2,jal=1,jalr=2" << std::endl
+              << "  --mix                   report the instruction mix" << std::endl
+              << "  --cache[=<levels>]      simulate caches, e.g. l1d=32k:8:64:lru:wb,l2=none" << std::endl
+              << "  (traces and the instruction mix run on their own threads)" << std::endl;
+    exit(1);
+}
+
+// the value of an option, which must be a whole number, exits otherwise
+static uint64_t parse_count(const std::string& arg)
+{
+    std::string text = arg.substr(arg.find('=') + 1);
+    std::istringstream in(text);
+    uint64_t count = 0;
+    char extra = 0;
+    // operator>> would wrap a negative count around
+    if (text.empty() || text[0] == '-' || !(in >> count) || (in >> extra)) {
+        std::cerr << "Invalid count in " << arg << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return count;
+}
+
+// the value of an option, which must be a positive finite number of
+// seconds, exits otherwise
+static double parse_seconds(const std::string& arg)
+{
+    std::istringstream in(arg.substr(arg.find('=') + 1));
+    double seconds = 0;
+    char extra = 0;
+    if (!(in >> seconds) || (in >> extra) || !std::isfinite(seconds) || seconds <= 0) {
+        std::cerr << "Invalid number of seconds in " << arg << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return seconds;
+}
+
+static void dump_state(const processor& proc, uint64_t retired)
+{
+    std::cout << "State after " << retired << " instructions: pc 0x" << std::hex
+              << std::setfill('0') << std::setw(8) << proc.read_pc() << std::endl;
+    for (size_t i = 0; i < 32; ++i) {
+        std::cout << "x" << std::dec << std::setfill(' ') << std::left << std::setw(2) << i
+                  << std::right << " 0x" << std::hex << std::setfill('0') << std::setw(8)
+                  << proc.read_reg(i) << ((i % 4 == 3) ? "\n" : "  ");
+    }
+    std::cout << std::dec << std::setfill(' ') << std::flush;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        std::cerr << "Invalid Syntax: peRISCVcope <program>" << std::endl;
-        exit(1);
+    std::string program;
+    std::string folded_file;
+    unsigned profile_hz = 0;
+    std::string trace_file;
+    bool mix = false;
+    bool caches = false;
+    std::string cache_spec;
+    size_t curves_line = 0;
+    bool predictors = false;
+    std::string predictor_spec;
+    bool timed = false;
+    std::string timing_spec;
+    bool fast = false;
+    std::string aot_file;
+    std::string code_cache;
+    unsigned compile_threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    instrs::features features;
+    std::string lockstep_spec;
+    std::string sample_spec;
+    std::string parallel_spec;
+    std::string record_file;
+    std::string replay_file;
+    bool seek = false;
+    bool natives = false;
+    std::string natives_spec;
+    uint64_t seek_target = 0;
+    uint64_t budget = ~static_cast<uint64_t>(0);
+    double timeout = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--folded=", 0) == 0) {
+            folded_file = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            trace_file = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--cache") {
+            caches = true;
+        } else if (arg.rfind("--cache=", 0) == 0) {
+            caches = true;
+            cache_spec = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--miss-curves") {
+            curves_line = 64;
+        } else if (arg.rfind("--miss-curves=", 0) == 0) {
+            curves_line = parse_count(arg);
+            if (curves_line == 0) {
+                std::cerr << "Invalid line size for the miss curves: 0" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--bpred") {
+            predictors = true;
+        } else if (arg.rfind("--bpred=", 0) == 0) {
+            predictors = true;
+            predictor_spec = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--timing") {
+            timed = true;
+        } else if (arg.rfind("--timing=", 0) == 0) {
+            timed = true;
+            timing_spec = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--fast") {
+            fast = true;
+        } else if (arg.rfind("--aot=", 0) == 0) {
+            aot_file = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--code-cache=", 0) == 0) {
+            code_cache = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--compile-threads=", 0) == 0) {
+            uint64_t threads = parse_count(arg);
+            compile_threads = static_cast<unsigned>(threads);
+            if (compile_threads != threads) {
+                std::cerr << "Invalid count in " << arg << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--isa=rv32i" || arg == "--isa=rv32im") {
+            features._rv32m = arg == "--isa=rv32im";
+        } else if (arg == "--no-align-checks") {
+            features._alignment = false;
+        } else if (arg == "--lockstep") {
+            lockstep_spec = "block";
+        } else if (arg.rfind("--lockstep=", 0) == 0) {
+            lockstep_spec = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--sample=", 0) == 0) {
+            sample_spec = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--intercept") {
+            natives = true;
+        } else if (arg.rfind("--intercept=", 0) == 0) {
+            natives = true;
+            natives_spec = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--max-instrs=", 0) == 0) {
+            budget = parse_count(arg);
+        } else if (arg.rfind("--deadline=", 0) == 0) {
+            timeout = parse_seconds(arg);
+        } else if (arg.rfind("--record=", 0) == 0) {
+            record_file = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--replay=", 0) == 0) {
+            replay_file = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--seek=", 0) == 0) {
+            seek = true;
+            seek_target = parse_count(arg);
+        } else if (arg.rfind("--parallel=", 0) == 0) {
+            parallel_spec = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--mix") {
+            mix = true;
+        } else if (arg == "--host-profile") {
+            profile_hz = 1000;
+        } else if (arg.rfind("--host-profile=", 0) == 0) {
+            // the timer period is a whole number of nanoseconds
+            uint64_t hz = parse_count(arg);
+            if (hz == 0 || hz > 1000000000) {
+                std::cerr << "Invalid sampling rate in " << arg << std::endl;
+                return EXIT_FAILURE;
+            }
+            profile_hz = static_cast<unsigned>(hz);
+        } else if (arg[0] == '-' || !program.empty()) {
+            usage();
+        } else {
+            program = arg;
+        }
     }
 
-   memory mem;
-   processor proc;
+    if (program.empty()) {
+        usage();
+    }
 
-   //map para hacer la relación instrucción-función
-   std::map <uint8_t, instr_emulation> dispatch_map = {
-       {0b0000011, instrs::load},
-       {0b0100011, instrs::store},
-       {0b0010011, instrs::alui},
-       {0b0110011, instrs::alur},
-       {0b0110111, instrs::lui},
-       {0b1101111, instrs::jal},
-       {0b1100011, instrs::condbranch}
-   };
+    // the checkpointing modes count instructions in fixed intervals
+    if (natives && (seek || !sample_spec.empty() || !parallel_spec.empty())) {
+        std::cerr << "--intercept only works with the reference and --fast engines" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // the block engine only drives the memory observers and the host profile
+    if (fast && (!folded_file.empty() || predictors || timed || mix || !trace_file.empty())) {
+        std::cerr << "--fast runs without the --folded, --bpred, --timing, --mix and --trace models" << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool lockstep = !lockstep_spec.empty();
+    if (lockstep && (fast || seek || !sample_spec.empty() || !parallel_spec.empty() || natives)) {
+        std::cerr << "--lockstep checks the --fast engine on its own, without --intercept" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!aot_file.empty() && (!(fast || lockstep) || seek || !sample_spec.empty() || !parallel_spec.empty())) {
+        std::cerr << "--aot only works with the --fast and --lockstep engines" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!code_cache.empty() && (!fast || seek || !sample_spec.empty() || !parallel_spec.empty()
+                || natives || !aot_file.empty())) {
+        std::cerr << "--code-cache only works with the --fast engine, without --intercept and --aot" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (features != instrs::features() && (seek || !sample_spec.empty() || !parallel_spec.empty())) {
+        std::cerr << "--isa and --no-align-checks only work with the reference, --fast and --lockstep engines"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool limited = budget != ~static_cast<uint64_t>(0) || timeout > 0;
+    if (limited && (seek || !sample_spec.empty() || !parallel_spec.empty())) {
+        std::cerr << "--max-instrs and --deadline only work with the reference and --fast engines" << std::endl;
+        return EXIT_FAILURE;
+    }
 
+   memory mem;
+   processor proc;
 
-   mem.load_binary(argv[1]);
+   mem.load_binary(program);
    mem.dump_hex(1);
 
    // read the entry point
@@ -42,26 +292,257 @@ int main(int argc, char *argv[])
    // the stack grows downward with the stack pointer always being 16-byte aligned
    proc.write_reg(processor::sp, memory::stack_top);
 
-   address_t pc = 0xDEADBEEF, next_pc = 0xDEADBEEF;
+   uint64_t exec_instrs = 0;
+
+   // inputs from the host, logged when recording and taken from the log
+   // when replaying; seeking, the parallel workers and the lockstep checker
+   // need a log as well
+   replay::environment env(!replay_file.empty() ? replay::mode::replay
+           : (!record_file.empty() || seek || !parallel_spec.empty() || lockstep) ? replay::mode::record
+           : replay::mode::live,
+           exec_instrs);
+   if (!replay_file.empty()) {
+       env.load(replay_file);
+   }
+   env.make_current();
+
+   sys::emulator syscalls(env);
+   syscalls.make_current();
+
+   std::unique_ptr<intercept::table> native_routines;
+   if (natives) {
+       native_routines = std::make_unique<intercept::table>(mem, intercept::parse(natives_spec));
+   }
+
+   std::unique_ptr<aot::module> translation;
+   if (!aot_file.empty()) {
+       translation = std::make_unique<aot::module>(aot_file, mem);
+   }
+
+   std::unique_ptr<prof::callstack> calls;
+   if (!folded_file.empty()) {
+       calls = std::make_unique<prof::callstack>(mem.entry_point());
+   }
+
+   std::unique_ptr<prof::sampler> host_profile;
+   prof::pc_counts pc_counts;
+   if (profile_hz > 0) {
+       host_profile = std::make_unique<prof::sampler>(profile_hz);
+   }
+
+   std::unique_ptr<cache::hierarchy> cache_model;
+   if (caches) {
+       cache_model = std::make_unique<cache::hierarchy>(cache::parse(cache_spec));
+       // sampled and parallel simulations attach it only while simulating in detail
+       if (sample_spec.empty() && parallel_spec.empty()) {
+           mem.attach(cache_model.get());
+       }
+   }
+
+   std::unique_ptr<cache::miss_ratio_curves> curves;
+   if (curves_line != 0) {
+       curves = std::make_unique<cache::miss_ratio_curves>(curves_line);
+       mem.attach(curves.get());
+   }
+
+   std::unique_ptr<bpred::simulator> branches;
+   if (predictors) {
+       branches = std::make_unique<bpred::simulator>(predictor_spec);
+   }
+
+   std::unique_ptr<timing::pipeline> pipeline;
+   if (timed && sample_spec.empty() && parallel_spec.empty()) {
+       pipeline = std::make_unique<timing::pipeline>(timing::parse(timing_spec));
+   }
 
-   size_t exec_instrs = 0;
+   // asynchronous analyses, fed with retire events
+   std::unique_ptr<analysis::dispatcher> events = std::make_unique<analysis::dispatcher>();
+   if (!trace_file.empty()) {
+       events->add_consumer(std::make_unique<analysis::trace_plugin>(trace_file,
+                   trace::snapshot(proc), proc.read_pc()));
+   }
+   if (mix) {
+       events->add_consumer(std::make_unique<analysis::mix_plugin>());
+   }
+   if (events->empty()) {
+       events.reset();
+   } else {
+       events->start();
+   }
 
    // Initialize sp
     proc.write_reg(2, memory::stack_top);
 
-   do
-   {
-       // main interpreter loop
-        pc = proc.read_pc();
-        uint32_t instr = mem.read<uint32_t>(pc);
+   std::unique_ptr<sampling::simulation> sampled;
+   std::unique_ptr<parallel::interval_simulation> intervals;
+   engine::result outcome{engine::status::halted, 0, 0};
+   bool diverged = false;
 
-        std::cout << "Reading instrucion" << std::endl;
+   // the timer starts with the run, the engines poll its flag
+   auto started = std::chrono::steady_clock::now();
+   std::unique_ptr<engine::deadline> time_limit;
+   if (timeout > 0) {
+       time_limit = std::make_unique<engine::deadline>(std::chrono::duration<double>(timeout));
+   }
+   const std::atomic<bool>* stop = time_limit ? &time_limit->flag() : nullptr;
 
-        next_pc = dispatch_map[(instr & 0x7F)](mem, proc, instr);
-
-        proc.write_pc(next_pc);
-       exec_instrs++;
-   } while (next_pc != pc); // look for while(1) in the code
+   if (seek) {
+       replay::timeline history;
+       history.run(mem, proc, env, exec_instrs);
+       uint64_t total = exec_instrs;
+       syscalls.set_echo(false);
+       history.seek(std::min(seek_target, total), mem, proc, env, exec_instrs);
+       dump_state(proc, exec_instrs);
+       exec_instrs = total;
+   } else if (!parallel_spec.empty()) {
+       intervals = std::make_unique<parallel::interval_simulation>(parallel::parse(parallel_spec),
+               timing::parse(timing_spec),
+               caches ? cache::parse(cache_spec) : std::vector<cache::config>(), mem);
+       intervals->run(mem, proc, exec_instrs);
+   } else if (!sample_spec.empty()) {
+       sampled = std::make_unique<sampling::simulation>(sampling::parse(sample_spec),
+               timing::parse(timing_spec), cache_model.get());
+       sampled->run(mem, proc, exec_instrs);
+   } else if (lockstep) {
+       // the block engine compiles in the background like with --fast
+       std::unique_ptr<engine::compiler> background;
+       if (compile_threads > 0) {
+           background = std::make_unique<engine::compiler>(compile_threads);
+       }
+       lockstep::checker checker(lockstep::parse(lockstep_spec), mem, proc, exec_instrs,
+               translation.get(), background.get());
+       engine::models models;
+       models._calls = calls.get();
+       models._sampler = host_profile.get();
+       models._counts = &pc_counts;
+       models._events = events.get();
+       models._branches = branches.get();
+       models._pipeline = pipeline.get();
+       models._stop = stop;
+       models._features = features;
+       outcome = checker.run(mem, proc, models, exec_instrs, budget);
+       diverged = checker.diverged();
+       checker.report(std::cout);
+   } else if (fast) {
+       // the guest runs the handlers until the optimised code is published
+       std::unique_ptr<engine::compiler> background;
+       if (compile_threads > 0) {
+           background = std::make_unique<engine::compiler>(compile_threads);
+       }
+       engine::block_engine blocks(native_routines.get(), translation.get());
+       blocks.configure(features);
+       blocks.stop_on(stop);
+       blocks.compile_on(background.get());
+       blocks.profile_on(host_profile.get(), &pc_counts);
+       std::string cache_file;
+       if (!code_cache.empty()) {
+           cache_file = codecache::path(code_cache, mem, features);
+           codecache::reader in(cache_file, mem, features);
+           std::cout << "Blocks loaded from the code cache: " << blocks.load(in, mem) << std::endl;
+       }
+       outcome = blocks.run(mem, proc, exec_instrs, budget);
+       if (!cache_file.empty()) {
+           codecache::writer out;
+           blocks.save(out);
+           out.save(cache_file, mem, features);
+       }
+       if (blocks.skipped() != 0) {
+           std::cout << "Instructions skipped in loops: " << blocks.skipped() << std::endl;
+       }
+       if (blocks.superblocks() != 0) {
+           std::cout << "Superblocks formed: " << blocks.superblocks() << std::endl;
+       }
+       if (translation) {
+           std::cout << "Instructions run translated: " << blocks.translated() << " ("
+                     << translation->blocks() << " blocks loaded)" << std::endl;
+       }
+   } else {
+       engine::models models;
+       models._calls = calls.get();
+       models._sampler = host_profile.get();
+       models._counts = &pc_counts;
+       models._events = events.get();
+       models._branches = branches.get();
+       models._pipeline = pipeline.get();
+       models._natives = native_routines.get();
+       models._stop = stop;
+       models._verbose = true;
+       models._features = features;
+       outcome = engine::run_reference(mem, proc, models, exec_instrs, budget);
+   }
+   time_limit.reset();
 
    std::cout << "Number of executed instructions: " << exec_instrs << std::endl;
+   bool stopped = outcome._status != engine::status::halted;
+   if (stopped) {
+       std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+       std::cout << "Stopped: " << (outcome._status == engine::status::limit
+                       ? "instruction budget exceeded" : "deadline exceeded") << std::endl
+                 << "  pc:      0x" << std::hex << std::setfill('0') << std::setw(8) << outcome._pc
+                 << std::dec << std::setfill(' ') << std::endl
+                 << "  retired: " << outcome._retired << std::endl
+                 << "  elapsed: " << std::fixed << std::setprecision(3) << elapsed.count() << " s"
+                 << std::defaultfloat << std::endl;
+   }
+   if (syscalls.exited()) {
+       std::cout << "Exit status: " << syscalls.status() << std::endl;
+   }
+
+   if (!record_file.empty()) {
+       env.save(record_file);
+       std::cout << "Recorded " << env.entries() << " inputs in " << env.bytes() << " bytes" << std::endl;
+   } else if (!replay_file.empty() && !seek && !env.exhausted()) {
+       std::cerr << "The run ended before the end of the replay log" << std::endl;
+   }
+
+   if (events) {
+       events->finish(std::cout);
+   }
+
+   if (intervals) {
+       intervals->report(std::cout);
+   } else if (sampled) {
+       sampled->report(std::cout, exec_instrs);
+   } else if (cache_model) {
+       cache_model->report(std::cout, mem);
+   }
+
+   if (curves) {
+       curves->report(std::cout);
+   }
+
+   if (branches) {
+       branches->report(std::cout, mem, exec_instrs);
+   }
+
+   if (pipeline) {
+       pipeline->report(std::cout);
+   }
+
+   if (native_routines) {
+       native_routines->report(std::cout);
+   }
+
+   if (host_profile) {
+       host_profile->report(std::cout, mem, pc_counts, exec_instrs);
+   }
+
+   if (calls) {
+       std::ofstream ofile(folded_file);
+       if (!ofile) {
+           std::cerr << "Unable to open " << folded_file << std::endl;
+           return EXIT_FAILURE;
+       }
+       calls->write_folded(ofile, mem, exec_instrs);
+   }
+
+   if (diverged) {
+       return EXIT_FAILURE;
+   }
+
+   // like timeout(1)
+   if (stopped) {
+       return 124;
+   }
+   return syscalls.exited() ? syscalls.status() : EXIT_SUCCESS;
 }
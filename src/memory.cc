@@ -1,14 +1,23 @@
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <sstream>
 
 #include <memory.hh>
 
+#include <sys/mman.h>
+
 using namespace mem;
 
+mapping::~mapping()
+{
+    ::munmap(_addr, _length);
+}
+
 // method dump_hex that receives a segment identifier and prints
 // the 32 bit in hexadecimal format
 
@@ -76,12 +85,69 @@ memory::load_binary(const std::string& binfile)
             seg._content.insert(seg._content.begin(),
                     _binary.begin() + phdr.p_offset,
                     _binary.begin() + phdr.p_offset + phdr.p_filesz);
+            // the rest up to the memory size is .bss
+            seg._content.resize(std::max(phdr.p_filesz, phdr.p_memsz));
+            seg.reset_bitmaps();
             _segments.push_back(seg);
         }
     }
 
-    // read ELF program header table,
-    // ... to be completed
+    load_symbols();
+}
+
+// read the function symbols from the section header table, if present
+void
+memory::load_symbols()
+{
+    if (_ehdr.e_shoff == 0) {
+        return;
+    }
+
+    auto section = [this](size_t i) {
+        return *reinterpret_cast<const Elf32_Shdr*>(_binary.data() + _ehdr.e_shoff + i * _ehdr.e_shentsize);
+    };
+
+    for (size_t i = 0; i < _ehdr.e_shnum; ++i) {
+        const Elf32_Shdr symtab = section(i);
+        if (symtab.sh_type != SHT_SYMTAB) {
+            continue;
+        }
+
+        const Elf32_Shdr strtab = section(symtab.sh_link);
+        const char* names = reinterpret_cast<const char*>(_binary.data() + strtab.sh_offset);
+
+        for (size_t off = 0; off + sizeof(Elf32_Sym) <= symtab.sh_size; off += sizeof(Elf32_Sym)) {
+            const Elf32_Sym sym = *reinterpret_cast<const Elf32_Sym*>(_binary.data() + symtab.sh_offset + off);
+            if (ELF32_ST_TYPE(sym.st_info) == STT_FUNC) {
+                _symbols[sym.st_value] = symbol{names + sym.st_name, sym.st_value, sym.st_size};
+            }
+        }
+    }
+}
+
+const symbol* memory::find_symbol(const std::string& name) const
+{
+    for (const auto& [addr, sym] : _symbols) {
+        if (sym._name == name) {
+            return &sym;
+        }
+    }
+    return nullptr;
+}
+
+std::string memory::symbol_name(address_t addr) const
+{
+    auto it = _symbols.upper_bound(addr);
+    if (it != _symbols.begin()) {
+        const symbol& sym = std::prev(it)->second;
+        if (addr < sym._address + sym._size || addr == sym._address) {
+            return sym._name;
+        }
+    }
+
+    std::ostringstream os;
+    os << "0x" << std::hex << addr;
+    return os.str();
 }
 
 
@@ -90,8 +156,9 @@ memory::load_binary(const std::string& binfile)
 void memory::dump_hex(size_t segment_id) const
 {
     const segment& seg = _segments[segment_id];
-    for (size_t i = 0; i < seg._content.size(); i+=4) {
-        uint32_t val = *reinterpret_cast<const uint32_t*>(&seg._content[i]);
+    for (size_t i = 0; i < seg.size(); i+=4) {
+        uint32_t val = *reinterpret_cast<const uint32_t*>(seg.data() + i);
         std::cout << std::hex << val << std::endl;
     }
+    std::cout << std::dec;
 }
\ No newline at end of file
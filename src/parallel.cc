@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <engine.hh>
+#include <parallel.hh>
+#include <replay.hh>
+#include <syscalls.hh>
+
+using namespace parallel;
+using namespace mem;
+
+params parallel::parse(const std::string& spec)
+{
+    params p{0, 0, std::max(2u, std::thread::hardware_concurrency()) - 1};
+    std::istringstream in(spec);
+    char sep = 0;
+    if (!(in >> p._interval) || p._interval == 0
+            || ((in >> sep) && (sep != ':' || !(in >> p._warm) || p._warm > p._interval))) {
+        std::cerr << "Invalid interval parameters: " << spec << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+interval_simulation::interval_simulation(const params& p, const timing::config& timing,
+        const std::vector<cache::config>& caches, const memory& base) :
+    _params(p), _timing(timing), _caches(caches), _base(base), _lock(), _ready(),
+    _checkpoints(), _cursors(), _logs(), _next(0), _done(false), _results()
+{
+    _base.detach_all();
+}
+
+void interval_simulation::worker()
+{
+    memory mem = _base;
+    processor proc;
+    engine::block_engine fast;
+    uint64_t retired = 0;
+
+    // inputs come from the log of the functional pass, output is not repeated
+    replay::environment env(replay::mode::replay, retired);
+    env.make_current();
+    sys::emulator syscalls(env);
+    syscalls.set_echo(false);
+    syscalls.make_current();
+
+    for (;;) {
+        size_t i;
+        std::shared_ptr<const ckpt::checkpoint> start, warm_from;
+        std::vector<uint8_t> log;
+        uint64_t log_start;
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            // an interval is handed out once its log is complete
+            _ready.wait(guard, [this] { return _done || _next < _logs.size(); });
+            if (_next >= _logs.size()) {
+                return;
+            }
+            i = _next++;
+            start = _checkpoints[i];
+            log_start = _cursors[i]._last;
+            if (i > 0) {
+                if (_params._warm > 0) {
+                    warm_from = _checkpoints[i - 1];
+                    log = *_logs[i - 1];
+                    log_start = _cursors[i - 1]._last;
+                }
+                // intervals are handed out in order, nobody needs them anymore
+                _checkpoints[i - 1].reset();
+                _logs[i - 1].reset();
+            }
+            log.insert(log.end(), _logs[i]->begin(), _logs[i]->end());
+        }
+        env.replay_log(std::move(log), log_start);
+
+        timing::pipeline pipeline(_timing);
+        std::unique_ptr<cache::hierarchy> caches;
+        if (!_caches.empty()) {
+            caches = std::make_unique<cache::hierarchy>(_caches);
+        }
+
+        engine::models models;
+        models._pipeline = &pipeline;
+
+        if (warm_from) {
+            ckpt::restore(*warm_from, mem, proc);
+            retired = warm_from->_retired;
+            fast.flush();
+            fast.run(mem, proc, retired, _params._interval - _params._warm);
+            if (caches) {
+                mem.attach(caches.get());
+            }
+            engine::run_reference(mem, proc, models, retired, _params._warm);
+            pipeline.reset_stats();
+            if (caches) {
+                caches->reset_stats();
+            }
+        } else {
+            ckpt::restore(*start, mem, proc);
+            retired = start->_retired;
+            if (caches) {
+                mem.attach(caches.get());
+            }
+        }
+
+        engine::run_reference(mem, proc, models, retired, _params._interval);
+        mem.detach_all();
+
+        result r{pipeline.get_stats(), {}};
+        if (caches) {
+            for (const auto& l : caches->levels()) {
+                r._caches.push_back(l->get_stats());
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(_lock);
+        if (_results.size() <= i) {
+            _results.resize(i + 1);
+        }
+        _results[i] = std::move(r);
+    }
+}
+
+void interval_simulation::run(memory& mem, processor& proc, uint64_t& retired)
+{
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < _params._threads; ++t) {
+        workers.emplace_back(&interval_simulation::worker, this);
+    }
+
+    replay::environment& env = replay::environment::current();
+    assert(env.get_mode() != replay::mode::live);
+
+    engine::block_engine fast;
+    auto last = std::make_shared<const ckpt::checkpoint>(ckpt::take(mem, proc, retired, nullptr));
+    replay::environment::cursor at = env.position();
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _checkpoints.push_back(last);
+        _cursors.push_back(at);
+    }
+
+    for (;;) {
+        bool halted = fast.run(mem, proc, retired, _params._interval)._status
+            == engine::status::halted;
+
+        replay::environment::cursor next = env.position();
+        auto log = std::make_shared<const std::vector<uint8_t>>(env.slice(at, next));
+        at = next;
+        if (!halted) {
+            last = std::make_shared<const ckpt::checkpoint>(ckpt::take(mem, proc, retired, last.get()));
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _logs.push_back(log);
+            if (halted) {
+                _done = true;
+            } else {
+                _checkpoints.push_back(last);
+                _cursors.push_back(at);
+            }
+        }
+        _ready.notify_all();
+
+        if (halted) {
+            break;
+        }
+    }
+
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+void interval_simulation::report(std::ostream& os) const
+{
+    timing::stats total{};
+    std::vector<cache::stats> levels;
+    for (const result& r : _results) {
+        total += r._timing;
+        levels.resize(std::max(levels.size(), r._caches.size()));
+        for (size_t l = 0; l < r._caches.size(); ++l) {
+            levels[l] += r._caches[l];
+        }
+    }
+
+    os << std::dec << "Parallel interval simulation: " << _results.size() << " intervals of "
+       << _params._interval << " instructions on " << _params._threads << " threads (warm "
+       << _params._warm << ")" << std::endl;
+    timing::pipeline::report(os, total);
+
+    if (levels.empty()) {
+        return;
+    }
+
+    cache::hierarchy names(_caches);
+    os << std::fixed << std::setprecision(2)
+       << "Cache    accesses      misses  miss%    evictions  writebacks" << std::endl;
+    for (size_t l = 0; l < levels.size(); ++l) {
+        const cache::stats& st = levels[l];
+        double rate = st.accesses() == 0 ? 0.0
+            : 100.0 * static_cast<double>(st.misses()) / static_cast<double>(st.accesses());
+        os << std::left << std::setw(5) << names.levels()[l]->cfg()._name << std::right
+           << std::setw(12) << st.accesses() << std::setw(12) << st.misses()
+           << std::setw(7) << rate << std::setw(13) << st._evictions
+           << std::setw(12) << st._writebacks << std::endl;
+    }
+    os.unsetf(std::ios::floatfield);
+}
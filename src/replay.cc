@@ -0,0 +1,169 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <replay.hh>
+
+using namespace replay;
+
+namespace {
+
+constexpr char log_magic[8] = "RVREPLY";
+constexpr uint32_t log_version = 1;
+
+struct log_header {
+    char _magic[8];
+    uint32_t _version;
+    uint32_t _reserved;
+};
+
+inline void put_varint(std::vector<uint8_t>& out, uint64_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+inline uint64_t get_varint(const std::vector<uint8_t>& in, size_t& pos)
+{
+    uint64_t v = 0;
+    for (unsigned shift = 0; pos < in.size(); shift += 7) {
+        uint8_t byte = in[pos++];
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return v;
+        }
+    }
+    std::cerr << "Truncated replay log" << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+} // namespace
+
+thread_local environment* environment::_current = nullptr;
+
+environment::environment(mode m, const uint64_t& retired) :
+    _mode(m), _retired(retired), _log(), _cursor{0, 0},
+    _start(std::chrono::steady_clock::now()), _entries(0)
+{
+}
+
+environment& environment::current()
+{
+    if (_current == nullptr) {
+        std::cerr << "No host environment for the guest" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return *_current;
+}
+
+uint64_t environment::host_clock() const
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start).count());
+}
+
+void environment::append(input k, uint64_t v)
+{
+    put_varint(_log, _retired - _cursor._last);
+    _log.push_back(static_cast<uint8_t>(k));
+    put_varint(_log, v);
+    _cursor = cursor{_log.size(), _retired};
+    _entries++;
+}
+
+void environment::append(input k, const uint8_t* data, size_t len)
+{
+    put_varint(_log, _retired - _cursor._last);
+    _log.push_back(static_cast<uint8_t>(k));
+    put_varint(_log, len);
+    _log.insert(_log.end(), data, data + len);
+    _cursor = cursor{_log.size(), _retired};
+    _entries++;
+}
+
+uint64_t environment::take(input k)
+{
+    if (exhausted()) {
+        std::cerr << "Replay log exhausted at instruction " << _retired << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    size_t pos = _cursor._pos;
+    uint64_t at = _cursor._last + get_varint(_log, pos);
+    if (at != _retired || pos >= _log.size() || _log[pos] != static_cast<uint8_t>(k)) {
+        std::cerr << "Replay diverged at instruction " << _retired << ", the log expects input "
+                  << (pos < _log.size() ? static_cast<unsigned>(_log[pos]) : 0u)
+                  << " at instruction " << at << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    pos++;
+    uint64_t v = get_varint(_log, pos);
+    _cursor = cursor{pos, at};
+    return v;
+}
+
+size_t environment::take(input k, uint8_t* data, size_t len)
+{
+    size_t n = take(k);
+    if (n > len || _cursor._pos + n > _log.size()) {
+        std::cerr << "Replay diverged at instruction " << _retired << ", " << n
+                  << " bytes of input do not fit in " << len << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    std::memcpy(data, &_log[_cursor._pos], n);
+    _cursor._pos += n;
+    return n;
+}
+
+void environment::rewind(const cursor& c)
+{
+    _mode = mode::replay;
+    _cursor = c;
+}
+
+void environment::replay_log(std::vector<uint8_t> log, uint64_t last)
+{
+    _log = std::move(log);
+    _mode = mode::replay;
+    _cursor = cursor{0, last};
+}
+
+void environment::load(const std::string& file)
+{
+    std::FILE* in = std::fopen(file.c_str(), "rb");
+    log_header header;
+    if (in == nullptr || std::fread(&header, sizeof(header), 1, in) != 1
+            || std::memcmp(header._magic, log_magic, sizeof(log_magic)) != 0
+            || header._version != log_version) {
+        std::cerr << "Unable to read replay log " << file << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    _log.clear();
+    uint8_t buffer[65536];
+    for (size_t n; (n = std::fread(buffer, 1, sizeof(buffer), in)) > 0; ) {
+        _log.insert(_log.end(), buffer, buffer + n);
+    }
+    std::fclose(in);
+
+    _mode = mode::replay;
+    _cursor = cursor{0, 0};
+}
+
+void environment::save(const std::string& file) const
+{
+    log_header header{};
+    std::memcpy(header._magic, log_magic, sizeof(log_magic));
+    header._version = log_version;
+
+    std::FILE* out = std::fopen(file.c_str(), "wb");
+    if (out == nullptr || std::fwrite(&header, sizeof(header), 1, out) != 1
+            || std::fwrite(_log.data(), 1, _log.size(), out) != _log.size()
+            || std::fclose(out) != 0) {
+        std::cerr << "Unable to write replay log " << file << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#include <instructions.hh>
+#include <sampler.hh>
+
+using namespace prof;
+using namespace mem;
+
+std::atomic<uint64_t> sampler::_current{0};
+std::array<uint64_t, sampler::ring_size> sampler::_ring;
+std::atomic<size_t> sampler::_head{0};
+std::atomic<size_t> sampler::_tail{0};
+std::atomic<size_t> sampler::_dropped{0};
+
+const char* prof::tier_name(tier t)
+{
+    switch (t) {
+        case tier::interpreter: return "interp";
+        case tier::blocks: return "blocks";
+        case tier::ir: return "ir";
+        case tier::compiled: return "aot";
+        case tier::native: return "native";
+    }
+    return "?";
+}
+
+uint64_t pc_counts::at(address_t pc) const
+{
+    auto it = _pages.find(pc >> (page_bits + 2));
+    return it == _pages.end() ? 0 : it->second[(pc >> 2) & ((1 << page_bits) - 1)];
+}
+
+void sampler::on_tick(int)
+{
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) == ring_size) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    _ring[head % ring_size] = _current.load(std::memory_order_relaxed);
+    _head.store(head + 1, std::memory_order_release);
+}
+
+sampler::sampler(unsigned hz) : _hz(hz), _timer(), _old_action(), _samples()
+{
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = on_tick;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &_old_action) != 0) {
+        std::cerr << "Unable to install the profiling signal handler" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    struct sigevent event;
+    std::memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &_timer) != 0) {
+        std::cerr << "Unable to create the profiling timer" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    // tv_nsec must stay below a second, so 1 Hz is a whole tv_sec
+    long nanos = 1000000000L / hz;
+    struct itimerspec period;
+    period.it_interval.tv_sec = nanos / 1000000000L;
+    period.it_interval.tv_nsec = nanos % 1000000000L;
+    period.it_value = period.it_interval;
+    if (timer_settime(_timer, 0, &period, nullptr) != 0) {
+        std::cerr << "Unable to start the profiling timer" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+sampler::~sampler()
+{
+    timer_delete(_timer);
+    sigaction(SIGPROF, &_old_action, nullptr);
+}
+
+void sampler::drain()
+{
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _head.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+        _samples[_ring[tail % ring_size]]++;
+    }
+    _tail.store(tail, std::memory_order_release);
+}
+
+void sampler::report(std::ostream& os, const memory& mem, const pc_counts& counts,
+        uint64_t retired)
+{
+    drain();
+
+    uint64_t total = 0;
+    std::map<std::pair<tier, uint8_t>, uint64_t> by_handler;
+    std::vector<std::pair<uint64_t, uint64_t>> hot; // samples, packed state
+    for (auto [state, n] : _samples) {
+        total += n;
+        by_handler[{static_cast<tier>(state >> 40), static_cast<uint8_t>(state >> 32)}] += n;
+        hot.emplace_back(n, state);
+    }
+    std::sort(hot.rbegin(), hot.rend());
+
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+    };
+
+    os << std::dec << std::fixed << std::setprecision(1)
+       << "Host-time profile: " << total << " samples at " << _hz << " Hz ("
+       << _dropped.load() << " dropped)" << std::endl
+       << "   host%  instr%  samples         retired          pc  tier    handler  function" << std::endl;
+
+    for (size_t i = 0; i < std::min<size_t>(hot.size(), 20); ++i) {
+        auto [n, state] = hot[i];
+        address_t pc = static_cast<address_t>(state);
+        os << std::setw(8) << percent(n, total)
+           << std::setw(8) << percent(counts.at(pc), retired)
+           << std::setw(9) << n
+           << std::setw(16) << counts.at(pc)
+           << "  0x" << std::hex << std::setw(8) << std::setfill('0') << pc
+           << std::dec << std::setfill(' ')
+           << "  " << std::left << std::setw(8) << tier_name(static_cast<tier>(state >> 40))
+           << std::setw(9) << instrs::opcode_name(static_cast<uint8_t>(state >> 32))
+           << mem.symbol_name(pc) << std::right << std::endl;
+    }
+
+    os << "   host%  tier    handler" << std::endl;
+    for (auto [key, n] : by_handler) {
+        os << std::setw(8) << percent(n, total) << "  " << std::left
+           << std::setw(8) << tier_name(key.first)
+           << instrs::opcode_name(key.second) << std::right << std::endl;
+    }
+    os.unsetf(std::ios::floatfield);
+}
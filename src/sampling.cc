@@ -0,0 +1,146 @@
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+
+#include <sampling.hh>
+
+using namespace sampling;
+using namespace mem;
+
+params sampling::parse(const std::string& spec)
+{
+    params p{0, 0, 0};
+    char sep1 = 0, sep2 = 0;
+    std::istringstream in(spec);
+    if (!(in >> p._fast >> sep1 >> p._warm >> sep2 >> p._measure) || sep1 != ':'
+            || sep2 != ':' || p._measure == 0) {
+        std::cerr << "Invalid sampling parameters: " << spec << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+double estimator::mean() const
+{
+    return _values.empty() ? 0.0
+        : std::accumulate(_values.begin(), _values.end(), 0.0) / static_cast<double>(_values.size());
+}
+
+double estimator::half_width(double z) const
+{
+    if (_values.size() < 2) {
+        return 0.0;
+    }
+    double m = mean();
+    double sq = 0.0;
+    for (double v : _values) {
+        sq += (v - m) * (v - m);
+    }
+    double n = static_cast<double>(_values.size());
+    return z * std::sqrt(sq / (n - 1)) / std::sqrt(n);
+}
+
+double ratio_estimator::ratio() const
+{
+    double num = 0.0, den = 0.0;
+    for (auto [y, x] : _values) {
+        num += y;
+        den += x;
+    }
+    return den == 0.0 ? 0.0 : num / den;
+}
+
+double ratio_estimator::half_width(double z) const
+{
+    if (_values.size() < 2) {
+        return 0.0;
+    }
+    // variance of the residuals y - r x, scaled by the mean denominator
+    double r = ratio();
+    double sq = 0.0, den = 0.0;
+    for (auto [y, x] : _values) {
+        sq += (y - r * x) * (y - r * x);
+        den += x;
+    }
+    double n = static_cast<double>(_values.size());
+    double mean_den = den / n;
+    return mean_den == 0.0 ? 0.0 : z * std::sqrt(sq / (n - 1)) / (std::sqrt(n) * mean_den);
+}
+
+simulation::simulation(const params& p, const timing::config& cfg, cache::hierarchy* caches) :
+    _params(p), _pipeline(cfg), _caches(caches), _fast(), _cpi(), _miss_rates(), _detailed(0)
+{
+}
+
+void simulation::run(memory& mem, processor& proc, uint64_t& retired)
+{
+    engine::models detailed;
+    detailed._pipeline = &_pipeline;
+
+    for (;;) {
+        if (_fast.run(mem, proc, retired, _params._fast)._status == engine::status::halted) {
+            return;
+        }
+
+        // the models see the same state the fast engine left behind
+        if (_caches) {
+            mem.attach(_caches);
+        }
+
+        auto warm = engine::run_reference(mem, proc, detailed, retired, _params._warm);
+        _detailed += warm._retired;
+        if (warm._status == engine::status::halted) {
+            break;
+        }
+
+        _pipeline.reset_stats();
+        if (_caches) {
+            _caches->reset_stats();
+        }
+
+        auto measured = engine::run_reference(mem, proc, detailed, retired, _params._measure);
+        _detailed += measured._retired;
+
+        // a sample cut short by the end of the program is still a sample
+        const timing::stats& st = _pipeline.get_stats();
+        if (st._instrs != 0) {
+            _cpi.add(static_cast<double>(st._cycles) / static_cast<double>(st._instrs));
+        }
+        if (_caches) {
+            for (const auto& l : _caches->levels()) {
+                const cache::stats& cs = l->get_stats();
+                _miss_rates[l->cfg()._name].add(static_cast<double>(cs.misses()),
+                        static_cast<double>(cs.accesses()));
+            }
+            mem.detach(_caches);
+        }
+
+        if (measured._status == engine::status::halted) {
+            return;
+        }
+    }
+
+    if (_caches) {
+        mem.detach(_caches);
+    }
+}
+
+void simulation::report(std::ostream& os, uint64_t retired) const
+{
+    os << std::dec << std::fixed << std::setprecision(4)
+       << "Sampled simulation: " << _cpi.samples() << " samples, " << _detailed << " of "
+       << retired << " instructions simulated in detail (fast " << _params._fast
+       << ", warm " << _params._warm << ", measure " << _params._measure << ")" << std::endl
+       << "  CPI             " << _cpi.mean() << " +- " << _cpi.half_width() << " (95%)" << std::endl
+       << "  cycles          " << std::setprecision(0) << _cpi.mean() * static_cast<double>(retired)
+       << " +- " << _cpi.half_width() * static_cast<double>(retired) << std::endl
+       << std::setprecision(4);
+    for (const auto& [name, est] : _miss_rates) {
+        os << "  " << std::left << std::setw(4) << name << std::right << " miss rate "
+           << 100.0 * est.ratio() << "% +- " << 100.0 * est.half_width() << "%" << std::endl;
+    }
+    os.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include <stackdist.hh>
+
+using namespace cache;
+
+void reuse_histogram::add(uint32_t distance)
+{
+    _total++;
+    if (distance < exact) {
+        _exact[distance]++;
+    } else {
+        _log[std::bit_width(distance) - 1]++;
+    }
+}
+
+uint64_t reuse_histogram::misses(uint64_t ways) const
+{
+    uint64_t hits = 0;
+    for (size_t d = 0; d < std::min<uint64_t>(ways, exact); ++d) {
+        hits += _exact[d];
+    }
+    // bucket b holds distances in [2^b, 2^(b+1))
+    for (size_t b = std::bit_width(exact) - 1; (static_cast<uint64_t>(2) << b) <= ways && b < _log.size(); ++b) {
+        hits += _log[b];
+    }
+    return _total - hits;
+}
+
+void stack_distance::set_stack::mark(uint32_t t, int32_t delta)
+{
+    for (; t < _fenwick.size(); t += t & -t) {
+        _fenwick[t] += delta;
+    }
+}
+
+uint32_t stack_distance::set_stack::prefix(uint32_t t) const
+{
+    uint32_t sum = 0;
+    for (; t > 0; t -= t & -t) {
+        sum += _fenwick[t];
+    }
+    return sum;
+}
+
+stack_distance::stack_distance(size_t line, unsigned max_set_bits) :
+    _line_bits(std::countr_zero(line)), _configs(max_set_bits + 1), _stacks(_configs),
+    _hist(_configs), _lines(), _times()
+{
+    if (line < 4 || !std::has_single_bit(line)) {
+        std::cerr << "Invalid line size for the miss curves: " << line << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    for (unsigned k = 0; k < _configs; ++k) {
+        _stacks[k].resize(static_cast<size_t>(1) << k);
+    }
+}
+
+// renumber the live times of a set from 1 and make room for as many again
+void stack_distance::compact(unsigned config, set_stack& s)
+{
+    std::vector<uint32_t> live;
+    live.reserve(s._live);
+    for (uint32_t t = 1; t <= s._now; ++t) {
+        if (s._owner[t] != none) {
+            live.push_back(s._owner[t]);
+        }
+    }
+
+    size_t capacity = std::bit_ceil(std::max<size_t>(2 * live.size() + 2, 16));
+    s._owner.assign(capacity, none);
+    s._fenwick.assign(capacity, 0);
+    s._now = 0;
+    for (uint32_t line : live) {
+        uint32_t t = ++s._now;
+        s._owner[t] = line;
+        s._fenwick[t] = 1;
+        _times[_lines.find(line)->second * _configs + config] = t;
+    }
+
+    // linear construction of the tree
+    for (uint32_t t = 1; t < capacity; ++t) {
+        uint32_t parent = t + (t & -t);
+        if (parent < capacity) {
+            s._fenwick[parent] += s._fenwick[t];
+        }
+    }
+}
+
+uint32_t stack_distance::push(unsigned config, set_stack& s, uint32_t line)
+{
+    if (s._now + 1 >= s._owner.size()) {
+        compact(config, s);
+    }
+    uint32_t t = ++s._now;
+    s._owner[t] = line;
+    s.mark(t, 1);
+    return t;
+}
+
+void stack_distance::access(mem::address_t addr)
+{
+    uint32_t line = addr >> _line_bits;
+
+    auto [it, inserted] = _lines.try_emplace(line, static_cast<uint32_t>(_lines.size()));
+    if (inserted) {
+        _times.resize(_times.size() + _configs, 0);
+    }
+    size_t row = static_cast<size_t>(it->second) * _configs;
+
+    for (unsigned k = 0; k < _configs; ++k) {
+        set_stack& s = _stacks[k][line & ((1u << k) - 1)];
+        uint32_t last = _times[row + k];
+        if (last == 0) {
+            _hist[k].add_cold();
+            s._live++;
+        } else {
+            _hist[k].add(s.prefix(s._now) - s.prefix(last));
+            s.mark(last, -1);
+            s._owner[last] = none;
+        }
+        _times[row + k] = push(k, s, line);
+    }
+}
+
+void miss_ratio_curves::report(std::ostream& os, const char* name, const stack_distance& sd)
+{
+    const reuse_histogram& full = sd.histogram(0);
+    if (full.total() == 0) {
+        return;
+    }
+
+    auto ratio = [](uint64_t misses, uint64_t total) {
+        return static_cast<double>(misses) / static_cast<double>(total);
+    };
+
+    constexpr unsigned assocs[] = {1, 2, 4, 8, 16};
+    os << std::dec << std::fixed << std::setprecision(4)
+       << name << " miss ratio, LRU, " << sd.line() << "-byte lines, "
+       << full.total() << " accesses" << std::endl
+       << "        size      1-way      2-way      4-way      8-way     16-way       full" << std::endl;
+
+    size_t max_lines = static_cast<size_t>(16) << (sd.configs() - 1);
+    for (size_t lines = 1; lines <= max_lines; lines *= 2) {
+        os << std::setw(11) << lines * sd.line() << 'B';
+        for (unsigned a : assocs) {
+            size_t sets = lines / a;
+            if (sets == 0 || std::countr_zero(sets) >= static_cast<int>(sd.configs())) {
+                os << std::setw(11) << '-';
+                continue;
+            }
+            const reuse_histogram& h = sd.histogram(std::countr_zero(sets));
+            os << std::setw(11) << ratio(h.misses(a), h.total());
+        }
+        os << std::setw(11) << ratio(full.misses(lines), full.total()) << std::endl;
+    }
+    os.unsetf(std::ios::floatfield);
+}
+
+void miss_ratio_curves::report(std::ostream& os) const
+{
+    report(os, "Instruction", _instr);
+    report(os, "Data", _data);
+}
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <syscalls.hh>
+
+using namespace sys;
+using namespace mem;
+
+namespace {
+
+// open flags of the guest ABI (asm-generic), translated for the host
+struct open_flag {
+    uint32_t _guest;
+    int _host;
+};
+
+constexpr std::array<open_flag, 8> open_flags{{
+    {00000100, O_CREAT},
+    {00000200, O_EXCL},
+    {00000400, O_NOCTTY},
+    {00001000, O_TRUNC},
+    {00002000, O_APPEND},
+    {00004000, O_NONBLOCK},
+    {00200000, O_DIRECTORY},
+    {02000000, O_CLOEXEC},
+}};
+
+constexpr int32_t guest_at_fdcwd = -100;
+
+// struct kernel_stat of newlib for riscv32
+constexpr size_t stat_size = 128;
+
+// mmap flags of the guest ABI
+constexpr uint32_t guest_map_shared = 0x01;
+constexpr uint32_t guest_map_private = 0x02;
+constexpr uint32_t guest_map_fixed = 0x10;
+constexpr uint32_t guest_map_anonymous = 0x20;
+
+inline address_t page_align(address_t addr)
+{
+    return (addr + page_size - 1) & ~static_cast<address_t>(page_size - 1);
+}
+
+inline address_t heap_base(const memory& mem)
+{
+    return page_align(mem.image_end());
+}
+
+// segment overlapping [addr, addr + len) with the lowest address, or -1;
+// in 64 bits as a range may end at 4 GiB
+ssize_t overlap(const memory& mem, uint64_t addr, size_t len)
+{
+    ssize_t found = -1;
+    const auto& segments = mem.segments();
+    for (size_t s = 0; s < segments.size(); ++s) {
+        uint64_t begin = segments[s]._initial_address;
+        if (begin < addr + len && addr < begin + segments[s].size()
+                && (found == -1 || begin < segments[found]._initial_address)) {
+            found = static_cast<ssize_t>(s);
+        }
+    }
+    return found;
+}
+
+inline int32_t host_result(long r)
+{
+    return r < 0 ? -errno : static_cast<int32_t>(r);
+}
+
+template<typename T>
+inline void put(uint8_t* buf, size_t offset, T value)
+{
+    std::memcpy(buf + offset, &value, sizeof(T));
+}
+
+} // namespace
+
+thread_local emulator* emulator::_current = nullptr;
+
+emulator::emulator(replay::environment& env) :
+    _env(env), _fds{0, 1, 2}, _echo(true), _exited(false), _status(0)
+{
+}
+
+emulator::~emulator()
+{
+    for (size_t fd = 3; fd < _fds.size(); ++fd) {
+        if (_fds[fd] >= 0) {
+            ::close(_fds[fd]);
+        }
+    }
+}
+
+emulator& emulator::current()
+{
+    if (_current == nullptr) {
+        std::cerr << "No syscall emulator for the guest" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return *_current;
+}
+
+int emulator::host_fd(uint32_t fd) const
+{
+    return fd < _fds.size() ? _fds[fd] : -1;
+}
+
+void emulator::input(memory& mem, address_t addr, uint8_t* dst, size_t len)
+{
+    _env.data(replay::input::data, dst, len, [](uint8_t*, size_t n) { return n; });
+    mem.mark_dirty(addr, len);
+}
+
+address_t emulator::ecall(memory& mem, processor& proc)
+{
+    uint32_t a0 = proc.read_reg(10), a1 = proc.read_reg(11), a2 = proc.read_reg(12),
+             a3 = proc.read_reg(13);
+    uint32_t n = proc.read_reg(17);
+    int32_t ret;
+
+    switch (n) {
+        case exit:
+        case exit_group:
+            _exited = true;
+            _status = static_cast<int32_t>(a0);
+            return proc.read_pc();
+        case openat: ret = do_openat(mem, a0, a1, a2, a3); break;
+        case close: ret = do_close(a0); break;
+        case lseek: ret = do_lseek(a0, static_cast<int32_t>(a1), a2); break;
+        case read: ret = do_read(mem, a0, a1, a2); break;
+        case write: ret = do_write(mem, a0, a1, a2); break;
+        case fstat: ret = do_fstat(mem, a0, a1); break;
+        case clock_gettime:
+        case clock_gettime64: ret = do_clock_gettime(mem, a0, a1); break;
+        case brk: ret = do_brk(mem, a0); break;
+        case mmap: ret = do_mmap(mem, a0, a1, a3, proc.read_reg(14), proc.read_reg(15)); break;
+        case munmap: ret = do_munmap(mem, a0, a1); break;
+        default:
+            std::cerr << "Unsupported syscall " << n << " at pc 0x" << std::hex
+                      << proc.read_pc() << std::dec << std::endl;
+            ret = -ENOSYS;
+    }
+
+    proc.write_reg(10, static_cast<uint32_t>(ret));
+    return proc.next_pc();
+}
+
+int32_t emulator::do_openat(memory& mem, uint32_t dirfd, address_t path, uint32_t flags,
+        uint32_t mode)
+{
+    // the path is only needed by the host
+    return result([&]() -> int32_t {
+        std::string name;
+        for (address_t addr = path; ; ++addr) {
+            const uint8_t* c = mem.host_ptr(addr, 1);
+            if (c == nullptr) {
+                return -EFAULT;
+            }
+            if (*c == 0) {
+                break;
+            }
+            name.push_back(static_cast<char>(*c));
+        }
+
+        int dir = static_cast<int32_t>(dirfd) == guest_at_fdcwd ? AT_FDCWD : host_fd(dirfd);
+        if (dir == -1) {
+            return -EBADF;
+        }
+
+        int host_flags = static_cast<int>(flags & 3) | O_CLOEXEC;
+        for (const open_flag& f : open_flags) {
+            if (flags & f._guest) {
+                host_flags |= f._host;
+            }
+        }
+
+        int fd = ::openat(dir, name.c_str(), host_flags, static_cast<mode_t>(mode));
+        if (fd < 0) {
+            return -errno;
+        }
+
+        // lowest free guest descriptor, like the kernel
+        size_t guest = 0;
+        while (guest < _fds.size() && _fds[guest] >= 0) {
+            guest++;
+        }
+        if (guest == _fds.size()) {
+            _fds.push_back(fd);
+        } else {
+            _fds[guest] = fd;
+        }
+        return static_cast<int32_t>(guest);
+    });
+}
+
+int32_t emulator::do_close(uint32_t fd)
+{
+    return result([&]() -> int32_t {
+        int h = host_fd(fd);
+        if (h < 0) {
+            return -EBADF;
+        }
+        // the host keeps its standard streams
+        int32_t ret = h > 2 ? host_result(::close(h)) : 0;
+        _fds[fd] = -1;
+        return ret;
+    });
+}
+
+int32_t emulator::do_lseek(uint32_t fd, int32_t offset, uint32_t whence)
+{
+    return result([&]() -> int32_t {
+        int h = host_fd(fd);
+        if (h < 0) {
+            return -EBADF;
+        }
+        off_t pos = ::lseek(h, offset, static_cast<int>(whence));
+        if (pos < 0) {
+            return -errno;
+        }
+        return pos > INT32_MAX ? -EOVERFLOW : static_cast<int32_t>(pos);
+    });
+}
+
+int32_t emulator::do_read(memory& mem, uint32_t fd, address_t buf, uint32_t count)
+{
+    uint8_t* dst = mem.host_ptr(buf, count);
+    if (dst == nullptr) {
+        return -EFAULT;
+    }
+
+    // straight into guest memory
+    int32_t n = result([&]() -> int32_t {
+        int h = host_fd(fd);
+        return h < 0 ? -EBADF : host_result(::read(h, dst, count));
+    });
+    if (n > 0) {
+        input(mem, buf, dst, static_cast<size_t>(n));
+    }
+    return n;
+}
+
+int32_t emulator::do_write(memory& mem, uint32_t fd, address_t buf, uint32_t count)
+{
+    const uint8_t* src = mem.host_ptr(buf, count);
+    if (src == nullptr) {
+        return -EFAULT;
+    }
+
+    int32_t n = result([&]() -> int32_t {
+        int h = host_fd(fd);
+        if (h < 0) {
+            return -EBADF;
+        }
+        // keep the order with the reports of the simulator
+        if (h == 1) {
+            std::cout.flush();
+        }
+        return host_result(::write(h, src, count));
+    });
+
+    if (_env.get_mode() == replay::mode::replay && _echo && n > 0 && (fd == 1 || fd == 2)) {
+        std::FILE* out = fd == 1 ? stdout : stderr;
+        std::cout.flush();
+        std::fwrite(src, 1, static_cast<size_t>(n), out);
+        std::fflush(out);
+    }
+    return n;
+}
+
+int32_t emulator::do_fstat(memory& mem, uint32_t fd, address_t buf)
+{
+    uint8_t* dst = mem.host_ptr(buf, stat_size);
+    if (dst == nullptr) {
+        return -EFAULT;
+    }
+
+    int32_t ret = result([&]() -> int32_t {
+        int h = host_fd(fd);
+        struct stat st;
+        if (h < 0) {
+            return -EBADF;
+        }
+        if (::fstat(h, &st) < 0) {
+            return -errno;
+        }
+        std::memset(dst, 0, stat_size);
+        put<uint64_t>(dst, 0, st.st_dev);
+        put<uint64_t>(dst, 8, st.st_ino);
+        put<uint32_t>(dst, 16, st.st_mode);
+        put<uint32_t>(dst, 20, static_cast<uint32_t>(st.st_nlink));
+        put<uint32_t>(dst, 24, st.st_uid);
+        put<uint32_t>(dst, 28, st.st_gid);
+        put<uint64_t>(dst, 32, st.st_rdev);
+        put<int64_t>(dst, 48, st.st_size);
+        put<int32_t>(dst, 56, static_cast<int32_t>(st.st_blksize));
+        put<int64_t>(dst, 64, st.st_blocks);
+        put<int64_t>(dst, 72, st.st_atim.tv_sec);
+        put<int32_t>(dst, 80, static_cast<int32_t>(st.st_atim.tv_nsec));
+        put<int64_t>(dst, 88, st.st_mtim.tv_sec);
+        put<int32_t>(dst, 96, static_cast<int32_t>(st.st_mtim.tv_nsec));
+        put<int64_t>(dst, 104, st.st_ctim.tv_sec);
+        put<int32_t>(dst, 112, static_cast<int32_t>(st.st_ctim.tv_nsec));
+        return 0;
+    });
+    if (ret == 0) {
+        input(mem, buf, dst, stat_size);
+    }
+    return ret;
+}
+
+// both the newlib timespec and the 64 bit one are {int64 sec, nsec}
+int32_t emulator::do_clock_gettime(memory& mem, uint32_t clock, address_t buf)
+{
+    uint8_t* dst = mem.host_ptr(buf, 16);
+    if (dst == nullptr) {
+        return -EFAULT;
+    }
+
+    int32_t ret = result([&]() -> int32_t {
+        struct timespec ts;
+        if (::clock_gettime(static_cast<clockid_t>(clock), &ts) < 0) {
+            return -errno;
+        }
+        put<int64_t>(dst, 0, ts.tv_sec);
+        put<int64_t>(dst, 8, ts.tv_nsec);
+        return 0;
+    });
+    if (ret == 0) {
+        input(mem, buf, dst, 16);
+    }
+    return ret;
+}
+
+// The heap is a segment from the page after the program image up to the
+// break; it only depends on guest state, so it is not logged.
+int32_t emulator::do_brk(memory& mem, address_t addr)
+{
+    address_t base = heap_base(mem);
+
+    auto& segments = mem.segments();
+    size_t heap = segments.size();
+    for (size_t s = 1; s < segments.size(); ++s) {
+        if (segments[s]._initial_address == base) {
+            heap = s;
+        }
+    }
+    address_t current = heap == segments.size() ? base
+        : base + static_cast<address_t>(segments[heap].size());
+
+    if (addr < base || addr - base > heap_limit
+            || addr > memory::stack_top - memory::stack_size) {
+        return static_cast<int32_t>(current);
+    }
+
+    if (heap == segments.size()) {
+        mem.add_segment(base, addr - base);
+    } else {
+        segments[heap].resize(addr - base);
+    }
+    return static_cast<int32_t>(addr);
+}
+
+// Mappings go bottom up from the top of the stack to 4 GiB, at the lowest
+// free range, which only depends on guest state. prot is ignored as
+// guest memory has no permissions. Recording logs the whole file-backed
+// part of a mapping, not only the pages the guest touches, and replays copy
+// it back into an ordinary segment.
+int32_t emulator::do_mmap(memory& mem, address_t addr, uint32_t length, uint32_t flags,
+        uint32_t fd, uint32_t pgoffset)
+{
+    size_t len = page_align(length);
+    bool anonymous = flags & guest_map_anonymous;
+    bool shared = flags & guest_map_shared;
+    if (len == 0 || shared == static_cast<bool>(flags & guest_map_private)) {
+        return -EINVAL;
+    }
+
+    address_t at = 0;
+    if (flags & guest_map_fixed) {
+        // replacing existing memory is not supported
+        if (addr % page_size != 0 || addr + len > uint64_t(1) << 32 || overlap(mem, addr, len) != -1) {
+            return -EINVAL;
+        }
+        at = addr;
+    } else {
+        uint64_t bottom = memory::stack_top;
+        while (at == 0 && bottom + len <= uint64_t(1) << 32) {
+            ssize_t s = overlap(mem, bottom, len);
+            if (s == -1) {
+                at = static_cast<address_t>(bottom);
+            } else {
+                const segment& seg = mem.segments()[s];
+                bottom = (seg._initial_address + seg.size() + page_size - 1) & ~(page_size - 1);
+            }
+        }
+        if (at == 0) {
+            return -ENOMEM;
+        }
+    }
+
+    std::shared_ptr<mapping> map;
+    size_t valid = anonymous ? 0 : len; // bytes backed by the file
+    int32_t ret = result([&]() -> int32_t {
+        int h = anonymous ? -1 : host_fd(fd);
+        if (!anonymous && h < 0) {
+            return -EBADF;
+        }
+        off_t offset = static_cast<off_t>(pgoffset) * static_cast<off_t>(page_size);
+        struct stat st;
+        if (!anonymous) {
+            if (::fstat(h, &st) < 0) {
+                return -errno;
+            }
+            // pages past the end of the file fault on the host
+            valid = st.st_size > offset
+                ? std::min<size_t>(len, page_align(static_cast<address_t>(st.st_size - offset))) : 0;
+        }
+        void* p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                (shared ? MAP_SHARED : MAP_PRIVATE) | (anonymous ? MAP_ANONYMOUS : 0), h,
+                anonymous ? 0 : offset);
+        if (p == MAP_FAILED) {
+            return -errno;
+        }
+        map = std::make_shared<mapping>(static_cast<uint8_t*>(p), len);
+        return static_cast<int32_t>(at);
+    });
+    if (static_cast<uint32_t>(ret) > static_cast<uint32_t>(-4096)) {
+        return ret;
+    }
+
+    size_t s = map ? mem.add_segment(at, map) : mem.add_segment(at, len);
+    mem.segments()[s]._mapped = true;
+    if (!anonymous) {
+        size_t logged = _env.data(replay::input::data, mem.segments()[s].data(), len,
+                [valid](uint8_t*, size_t) { return valid; });
+        if (logged > 0) {
+            mem.mark_dirty(at, logged);
+        }
+    }
+    return ret;
+}
+
+int32_t emulator::do_munmap(memory& mem, address_t addr, uint32_t length)
+{
+    // whole mappings only, never the image, the heap or the stack
+    auto& segments = mem.segments();
+    for (size_t s = 0; s < segments.size(); ++s) {
+        if (segments[s]._mapped && segments[s]._initial_address == addr && segments[s].size() == page_align(length)) {
+            mem.remove_segment(s);
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
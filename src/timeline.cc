@@ -0,0 +1,37 @@
+#include <algorithm>
+#include <cassert>
+
+#include <engine.hh>
+#include <timeline.hh>
+
+using namespace replay;
+using namespace mem;
+
+void timeline::run(memory& mem, processor& proc, environment& env, uint64_t& retired)
+{
+    assert(env.get_mode() != mode::live);
+    engine::block_engine fast;
+    for (;;) {
+        const ckpt::checkpoint* prev = _points.empty() ? nullptr : &_points.back()._state;
+        _points.push_back(point{ckpt::take(mem, proc, retired, prev), env.position()});
+        if (fast.run(mem, proc, retired, _interval)._status == engine::status::halted) {
+            break;
+        }
+    }
+}
+
+void timeline::seek(uint64_t target, memory& mem, processor& proc, environment& env,
+        uint64_t& retired) const
+{
+    assert(!_points.empty() && target >= _points.front()._state._retired);
+    size_t i = std::min<size_t>((target - _points.front()._state._retired) / _interval,
+            _points.size() - 1);
+    const point& p = _points[i];
+
+    ckpt::restore(p._state, mem, proc);
+    env.rewind(p._cursor);
+    retired = p._state._retired;
+
+    engine::block_engine fast;
+    fast.run(mem, proc, retired, target - retired);
+}
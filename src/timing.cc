@@ -0,0 +1,135 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <instructions.hh>
+#include <timing.hh>
+
+using namespace timing;
+using namespace mem;
+
+stats& stats::operator+=(const stats& o)
+{
+    _instrs += o._instrs;
+    _cycles += o._cycles;
+    _load_use += o._load_use;
+    _branch += o._branch;
+    _jump += o._jump;
+    _mul += o._mul;
+    return *this;
+}
+
+config timing::parse(const std::string& spec)
+{
+    config cfg;
+    std::istringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        auto eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        unsigned* field = key == "mul" ? &cfg._mul_latency
+            : key == "branch" ? &cfg._branch_penalty
+            : key == "jal" ? &cfg._jal_penalty
+            : key == "jalr" ? &cfg._jalr_penalty : nullptr;
+        if (field == nullptr || eq == std::string::npos) {
+            std::cerr << "Invalid timing parameter: " << item << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        *field = std::stoul(item.substr(eq + 1));
+    }
+    if (cfg._mul_latency == 0) {
+        cfg._mul_latency = 1;
+    }
+    return cfg;
+}
+
+void pipeline::retire(uint32_t bitstream, address_t pc, address_t next_pc)
+{
+    uint8_t rs1 = 0, rs2 = 0, rd = 0;
+    bool is_load = false;
+    unsigned stalls = 0;
+
+    switch (bitstream & 0x7F) {
+        case 0b0000011: { // load
+            instrs::i_instruction ii{bitstream};
+            rs1 = ii.rs1();
+            rd = ii.rd();
+            is_load = true;
+            break;
+        }
+        case 0b0100011: // store, rs2 is forwarded to MEM
+            rs1 = instrs::s_instruction{bitstream}.rs1();
+            break;
+        case 0b0010011: { // alui
+            instrs::i_instruction ii{bitstream};
+            rs1 = ii.rs1();
+            rd = ii.rd();
+            break;
+        }
+        case 0b0110011: { // alur
+            instrs::r_instruction ri{bitstream};
+            rs1 = ri.rs1();
+            rs2 = ri.rs2();
+            rd = ri.rd();
+            if (ri.funct7() == 0b0000001) {
+                stalls += _cfg._mul_latency - 1;
+                _stats._mul += _cfg._mul_latency - 1;
+            }
+            break;
+        }
+        case 0b0110111: // lui
+            rd = instrs::u_instruction{bitstream}.rd();
+            break;
+        case 0b1101111: // jal
+            rd = instrs::j_instruction{bitstream}.rd();
+            stalls += _cfg._jal_penalty;
+            _stats._jump += _cfg._jal_penalty;
+            break;
+        case 0b1100111: { // jalr
+            instrs::i_instruction ii{bitstream};
+            rs1 = ii.rs1();
+            rd = ii.rd();
+            stalls += _cfg._jalr_penalty;
+            _stats._jump += _cfg._jalr_penalty;
+            break;
+        }
+        case 0b1100011: { // branch
+            instrs::b_instruction bi{bitstream};
+            rs1 = bi.rs1();
+            rs2 = bi.rs2();
+            if (next_pc != pc + 4) {
+                stalls += _cfg._branch_penalty;
+                _stats._branch += _cfg._branch_penalty;
+            }
+            break;
+        }
+    }
+
+    if (_load_rd != 0 && (rs1 == _load_rd || rs2 == _load_rd)) {
+        stalls++;
+        _stats._load_use++;
+    }
+    _load_rd = is_load ? rd : 0;
+
+    _stats._instrs++;
+    _stats._cycles += 1 + stalls;
+}
+
+void pipeline::report(std::ostream& os, const stats& st)
+{
+    uint64_t cycles = st._cycles + (st._instrs ? depth - 1 : 0);
+    auto per_instr = [&st](uint64_t n) {
+        return st._instrs == 0 ? 0.0 : static_cast<double>(n) / static_cast<double>(st._instrs);
+    };
+
+    os << std::dec << std::fixed << std::setprecision(3)
+       << "Pipeline: " << cycles << " cycles, " << st._instrs << " instructions, CPI "
+       << per_instr(cycles) << std::endl
+       << "  stall cycles     cycles  per instr" << std::endl
+       << "  load-use   " << std::setw(12) << st._load_use << std::setw(11) << per_instr(st._load_use) << std::endl
+       << "  branch     " << std::setw(12) << st._branch << std::setw(11) << per_instr(st._branch) << std::endl
+       << "  jump       " << std::setw(12) << st._jump << std::setw(11) << per_instr(st._jump) << std::endl
+       << "  multiply   " << std::setw(12) << st._mul << std::setw(11) << per_instr(st._mul) << std::endl;
+    os.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,345 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <trace.hh>
+
+using namespace trace;
+using namespace mem;
+
+namespace {
+
+constexpr char trace_magic[8] = "RVTRACE";
+constexpr char index_magic[8] = "RVTIDX";
+
+inline uint32_t zigzag(int32_t v) { return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31); }
+inline int32_t unzigzag(uint32_t v) { return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1); }
+
+inline void put_varint(std::vector<uint8_t>& out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+inline uint32_t get_varint(const std::vector<uint8_t>& in, size_t& pos)
+{
+    uint32_t v = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        uint8_t byte = in[pos++];
+        v |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return v;
+        }
+    }
+}
+
+template<typename T>
+void write_or_die(std::FILE* file, const T* data, size_t n = 1)
+{
+    if (std::fwrite(data, sizeof(T), n, file) != n) {
+        std::cerr << "Unable to write the trace" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+} // namespace
+
+address_t trace::predict_next(uint32_t instr, address_t pc, const regs_t& regs)
+{
+    switch (instr & 0x7F) {
+        case 0b1101111: return pc + instrs::j_instruction{instr}.imm();
+        case 0b1100111: {
+            instrs::i_instruction ii{instr};
+            return (regs[ii.rs1()] + ii.imm()) & ~static_cast<address_t>(1);
+        }
+    }
+    return pc + 4;
+}
+
+// writer
+
+writer::writer(const std::string& path, uint32_t block_bytes) :
+    _file(std::fopen(path.c_str(), "wb")), _block_bytes(block_bytes), _payload(),
+    _index(), _block(), _regs(), _next_pc(0), _records(0), _dict()
+{
+    if (_file == nullptr) {
+        std::cerr << "Unable to open " << path << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    file_header header;
+    std::memcpy(header._magic, trace_magic, sizeof(header._magic));
+    header._version = version;
+    header._block_bytes = block_bytes;
+    write_or_die(_file, &header);
+
+    _payload.reserve(block_bytes + 16);
+    _block._count = 0;
+}
+
+writer::~writer()
+{
+    close();
+}
+
+void writer::flush()
+{
+    if (_block._count == 0) {
+        return;
+    }
+
+    _block._payload = static_cast<uint32_t>(_payload.size());
+    _index.push_back(index_entry{static_cast<uint64_t>(std::ftell(_file)), _block._first, _block._count, 0});
+    write_or_die(_file, &_block);
+    write_or_die(_file, _payload.data(), _payload.size());
+
+    _payload.clear();
+    _block._count = 0;
+}
+
+void writer::sync(const regs_t& regs, address_t pc)
+{
+    flush();
+    _regs = regs;
+    _next_pc = pc;
+    _dict.fill({~static_cast<address_t>(0), 0});
+    _block._first = _records;
+    _block._pc = pc;
+    _block._regs = regs;
+    _block._reserved = 0;
+}
+
+void writer::append(const record& rec)
+{
+    if (_payload.size() >= _block_bytes) {
+        sync(_regs, _next_pc);
+    }
+
+    // memory operands must be derivable from the shadow registers
+    assert(rec.mem_size == 0 || rec.mem_addr == access_address(rec.instr, _regs));
+
+    uint8_t header = 0;
+    size_t header_pos = _payload.size();
+    _payload.push_back(0);
+
+    if (rec.pc != _next_pc) {
+        header |= 1;
+        put_varint(_payload, zigzag(static_cast<int32_t>(rec.pc - _next_pc)));
+    }
+
+    auto& entry = _dict[(rec.pc >> 2) % dict_size];
+    if (entry.first != rec.pc || entry.second != rec.instr) {
+        header |= 2;
+        entry = {rec.pc, rec.instr};
+        for (unsigned i = 0; i < 4; ++i) {
+            _payload.push_back(static_cast<uint8_t>(rec.instr >> (8 * i)));
+        }
+    }
+
+    _next_pc = predict_next(rec.instr, rec.pc, _regs);
+
+    // loads into x0 still carry the loaded value
+    bool has_value = rec.rd != 0 || (rec.mem_size != 0 && !rec.mem_write);
+    if (has_value) {
+        uint32_t value = rec.rd != 0 ? rec.rd_value : rec.mem_value;
+        uint32_t delta = zigzag(static_cast<int32_t>(value - _regs[rec.rd]));
+        if (delta < 63) {
+            header |= (delta + 1) << 2;
+        } else {
+            put_varint(_payload, delta);
+        }
+        if (rec.rd != 0) {
+            _regs[rec.rd] = value;
+        }
+    }
+
+    _payload[header_pos] = header;
+    _block._count++;
+    _records++;
+}
+
+void writer::close()
+{
+    if (_file == nullptr) {
+        return;
+    }
+
+    flush();
+
+    footer foot;
+    foot._index_offset = static_cast<uint64_t>(std::ftell(_file));
+    foot._blocks = _index.size();
+    foot._records = _records;
+    std::memcpy(foot._magic, index_magic, sizeof(foot._magic));
+    write_or_die(_file, _index.data(), _index.size());
+    write_or_die(_file, &foot);
+
+    std::fclose(_file);
+    _file = nullptr;
+}
+
+// reader
+
+reader::reader(const std::string& path) :
+    _file(std::fopen(path.c_str(), "rb")), _index(), _records(0), _next_block(0),
+    _payload(), _pos(0), _left(0), _current(0), _regs(), _next_pc(0), _dict()
+{
+    if (_file == nullptr) {
+        std::cerr << "Unable to open " << path << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    file_header header;
+    if (std::fread(&header, sizeof(header), 1, _file) != 1
+            || std::memcmp(header._magic, trace_magic, sizeof(header._magic)) != 0
+            || header._version != version) {
+        std::cerr << path << " is not a trace (version " << version << ")" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    footer foot;
+    std::fseek(_file, -static_cast<long>(sizeof(foot)), SEEK_END);
+    if (std::fread(&foot, sizeof(foot), 1, _file) == 1
+            && std::memcmp(foot._magic, index_magic, sizeof(foot._magic)) == 0) {
+        _index.resize(foot._blocks);
+        std::fseek(_file, static_cast<long>(foot._index_offset), SEEK_SET);
+        if (std::fread(_index.data(), sizeof(index_entry), _index.size(), _file) != _index.size()) {
+            _index.clear();
+        }
+        _records = foot._records;
+    }
+
+    // a trace from an interrupted run has no index, rebuild it
+    if (_index.empty()) {
+        scan_blocks();
+    }
+
+    seek(0);
+}
+
+reader::~reader()
+{
+    std::fclose(_file);
+}
+
+void reader::scan_blocks()
+{
+    _records = 0;
+    long offset = sizeof(file_header);
+    block_header block;
+    std::fseek(_file, offset, SEEK_SET);
+    while (std::fread(&block, sizeof(block), 1, _file) == 1) {
+        _index.push_back(index_entry{static_cast<uint64_t>(offset), block._first, block._count, 0});
+        _records = block._first + block._count;
+        offset += sizeof(block) + block._payload;
+        if (std::fseek(_file, offset, SEEK_SET) != 0) {
+            break;
+        }
+    }
+}
+
+bool reader::load_block(size_t i)
+{
+    if (i >= _index.size()) {
+        return false;
+    }
+
+    block_header block;
+    std::fseek(_file, static_cast<long>(_index[i]._offset), SEEK_SET);
+    if (std::fread(&block, sizeof(block), 1, _file) != 1) {
+        return false;
+    }
+    _payload.resize(block._payload);
+    if (std::fread(_payload.data(), 1, _payload.size(), _file) != _payload.size()) {
+        return false;
+    }
+
+    _pos = 0;
+    _left = block._count;
+    _current = block._first;
+    _regs = block._regs;
+    _next_pc = block._pc;
+    _dict.fill({~static_cast<address_t>(0), 0});
+    _next_block = i + 1;
+    return true;
+}
+
+void reader::seek(uint64_t record_index)
+{
+    // last block starting at or before the record
+    size_t i = 0;
+    while (i + 1 < _index.size() && _index[i + 1]._first <= record_index) {
+        ++i;
+    }
+    if (!load_block(i)) {
+        _left = 0;
+        return;
+    }
+
+    record rec;
+    while (_current < record_index && next(rec)) {
+    }
+}
+
+bool reader::next(record& rec)
+{
+    while (_left == 0) {
+        if (!load_block(_next_block)) {
+            return false;
+        }
+    }
+
+    uint8_t header = _payload[_pos++];
+
+    rec.pc = _next_pc;
+    if (header & 1) {
+        rec.pc += static_cast<uint32_t>(unzigzag(get_varint(_payload, _pos)));
+    }
+
+    auto& entry = _dict[(rec.pc >> 2) % dict_size];
+    if (header & 2) {
+        uint32_t instr = 0;
+        for (unsigned i = 0; i < 4; ++i) {
+            instr |= static_cast<uint32_t>(_payload[_pos++]) << (8 * i);
+        }
+        entry = {rec.pc, instr};
+    }
+    rec.instr = entry.second;
+
+    rec.mem_size = 0;
+    rec.mem_write = false;
+    if (is_load(rec.instr) || is_store(rec.instr)) {
+        rec.mem_size = access_size(rec.instr);
+        rec.mem_write = is_store(rec.instr);
+        rec.mem_addr = access_address(rec.instr, _regs);
+        rec.mem_value = rec.mem_write ? _regs[(rec.instr >> 20) & 0x1F] : 0;
+    }
+
+    _next_pc = predict_next(rec.instr, rec.pc, _regs);
+
+    rec.rd = dest_reg(rec.instr);
+    rec.rd_value = 0;
+    if (rec.rd != 0 || (rec.mem_size != 0 && !rec.mem_write)) {
+        uint32_t delta = header >> 2;
+        delta = delta != 0 ? delta - 1 : get_varint(_payload, _pos);
+        uint32_t value = _regs[rec.rd] + static_cast<uint32_t>(unzigzag(delta));
+        if (rec.rd != 0) {
+            _regs[rec.rd] = value;
+            rec.rd_value = value;
+        }
+        if (!rec.mem_write && rec.mem_size != 0) {
+            rec.mem_value = value;
+        }
+    }
+
+    if (rec.mem_size != 0 && rec.mem_size < 4) {
+        rec.mem_value &= (1u << (8 * rec.mem_size)) - 1;
+    }
+
+    _left--;
+    _current++;
+    return true;
+}
@@ -0,0 +1,149 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <trace.hh>
+
+// Command line companion of the binary trace format: stream, filter and
+// convert traces written with periscvcope --trace=<file>.
+
+struct filter {
+    uint64_t from = 0;
+    uint64_t count = ~static_cast<uint64_t>(0);
+    mem::address_t pc_lo = 0;
+    mem::address_t pc_hi = ~static_cast<mem::address_t>(0);
+    bool mem_only = false;
+
+    bool match(const trace::record& rec) const
+    {
+        return rec.pc >= pc_lo && rec.pc <= pc_hi && (!mem_only || rec.mem_size != 0);
+    }
+};
+
+static void usage()
+{
+    std::cerr << "Invalid Syntax: periscvcope-trace <command> <trace> [options]" << std::endl
+              << "  info                   blocks, records and bytes per record" << std::endl
+              << "  dump                   one line of text per record" << std::endl
+              << "  csv                    comma separated values" << std::endl
+              << "  filter --out=<trace>   binary trace with the matching records" << std::endl
+              << "options: --from=<n> --count=<n> --pc=<lo>:<hi> --mem" << std::endl;
+    exit(1);
+}
+
+static void print_text(std::ostream& os, uint64_t i, const trace::record& rec)
+{
+    os << std::dec << std::setw(12) << i << std::hex << std::setfill('0')
+       << "  " << std::setw(8) << rec.pc << "  " << std::setw(8) << rec.instr
+       << std::setfill(' ') << "  " << std::left << std::setw(7)
+       << instrs::opcode_name(rec.instr & 0x7F) << std::right;
+    if (rec.rd != 0) {
+        os << "  x" << std::dec << unsigned(rec.rd) << "=0x" << std::hex << rec.rd_value;
+    }
+    if (rec.mem_size != 0) {
+        os << (rec.mem_write ? "  st" : "  ld") << std::dec << unsigned(rec.mem_size)
+           << " [0x" << std::hex << rec.mem_addr << "]=0x" << rec.mem_value;
+    }
+    os << '\n';
+}
+
+static void print_csv(std::ostream& os, uint64_t i, const trace::record& rec)
+{
+    os << std::dec << i << ",0x" << std::hex << rec.pc << ",0x" << rec.instr << ','
+       << std::dec << unsigned(rec.rd) << ",0x" << std::hex << rec.rd_value << ','
+       << std::dec << unsigned(rec.mem_size) << ',' << (rec.mem_write ? 'w' : 'r')
+       << ",0x" << std::hex << rec.mem_addr << ",0x" << rec.mem_value << '\n';
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        usage();
+    }
+
+    std::string command = argv[1];
+    trace::reader in(argv[2]);
+
+    filter f;
+    std::string out_file;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value = arg.substr(arg.find('=') + 1);
+        if (arg.rfind("--from=", 0) == 0) {
+            f.from = std::stoull(value);
+        } else if (arg.rfind("--count=", 0) == 0) {
+            f.count = std::stoull(value);
+        } else if (arg.rfind("--pc=", 0) == 0) {
+            f.pc_lo = std::stoul(value.substr(0, value.find(':')), nullptr, 0);
+            f.pc_hi = std::stoul(value.substr(value.find(':') + 1), nullptr, 0);
+        } else if (arg == "--mem") {
+            f.mem_only = true;
+        } else if (arg.rfind("--out=", 0) == 0) {
+            out_file = value;
+        } else {
+            usage();
+        }
+    }
+
+    if (command == "info") {
+        uint64_t payload = 0;
+        std::cout << "records: " << in.records() << std::endl
+                  << "blocks:  " << in.blocks().size() << std::endl;
+        for (size_t i = 0; i + 1 < in.blocks().size(); ++i) {
+            payload += in.blocks()[i + 1]._offset - in.blocks()[i]._offset - sizeof(trace::block_header);
+        }
+        if (in.blocks().size() > 1) {
+            uint64_t records = in.blocks().back()._first;
+            std::cout << "bytes/record: " << std::fixed << std::setprecision(3)
+                      << static_cast<double>(payload) / static_cast<double>(records)
+                      << " (excluding the last block)" << std::endl;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<trace::writer> out;
+    if (command == "filter") {
+        if (out_file.empty()) {
+            usage();
+        }
+        out = std::make_unique<trace::writer>(out_file);
+    } else if (command != "dump" && command != "csv") {
+        usage();
+    }
+
+    if (command == "csv") {
+        std::cout << "index,pc,instr,rd,rd_value,mem_size,mem_rw,mem_addr,mem_value\n";
+    }
+
+    in.seek(f.from);
+    trace::record rec;
+    bool contiguous = false;
+    for (uint64_t n = 0; n < f.count; ++n) {
+        uint64_t i = in.position();
+        trace::regs_t regs = in.regs();
+        if (!in.next(rec)) {
+            break;
+        }
+        if (!f.match(rec)) {
+            contiguous = false;
+            continue;
+        }
+
+        if (out) {
+            // records were skipped, restart from the reader registers
+            if (!contiguous) {
+                out->sync(regs, rec.pc);
+            }
+            out->append(rec);
+            contiguous = true;
+        } else if (command == "dump") {
+            print_text(std::cout, i, rec);
+        } else {
+            print_csv(std::cout, i, rec);
+        }
+    }
+
+    return 0;
+}